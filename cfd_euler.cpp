@@ -5,6 +5,10 @@
 #include <iomanip>
 #include <algorithm>
 #include <sstream>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <omp.h>
 
 
 using namespace std;
@@ -15,6 +19,26 @@ using namespace std;
 const double gamma_val = 1.4;   // Ratio of specific heats
 const double CFL = 0.5;         // CFL number
 
+// ----- Grid and domain parameters -----
+const int Nx = 200;         // Number of cells in x (excluding ghost cells)
+const int Ny = 100;         // Number of cells in y
+const double Lx = 2.0;      // Domain length in x
+const double Ly = 1.0;      // Domain length in y
+const double dx = Lx / Nx;
+const double dy = Ly / Ny;
+const int total_size = (Nx + 2) * (Ny + 2);
+
+// ----- Free-stream initial conditions (inflow) -----
+const double rho0 = 1.0;
+const double u0 = 1.0;
+const double v0 = 0.0;
+const double p0 = 1.0;
+const double E0 = p0/(gamma_val - 1.0) + 0.5*rho0*(u0*u0 + v0*v0);
+
+// ----- Time step from the CFL condition -----
+const double c0 = sqrt(gamma_val * p0 / rho0);
+const double dt = CFL * min(dx, dy) / (fabs(u0) + c0)/2.0;
+
 // ------------------------------------------------------------
 // Compute pressure from the conservative variables
 // ------------------------------------------------------------
@@ -52,57 +76,51 @@ void fluxY(double rho, double rhou, double rhov, double E,
 }
 
 // ------------------------------------------------------------
-// Main simulation routine
+// Primitive variables of every cell, one array per quantity, indexed like the fields
 // ------------------------------------------------------------
-int main(){
-    // ----- Grid and domain parameters -----
-    const int Nx = 200;         // Number of cells in x (excluding ghost cells)
-    const int Ny = 100;         // Number of cells in y
-    const double Lx = 2.0;      // Domain length in x
-    const double Ly = 1.0;      // Domain length in y
-    const double dx = Lx / Nx;
-    const double dy = Ly / Ny;
+struct Primitives {
+    double *u, *v, *p;
+    double *c2;                 // squared sound speed; a sqrt here would keep the stage from vectorising
+};
 
-    // Create flat arrays (with ghost cells)
-    const int total_size = (Nx + 2) * (Ny + 2);
-    
-    double* rho = (double*)malloc(total_size * sizeof(double));
-    double* rhou = (double*)malloc(total_size * sizeof(double));
-    double* rhov = (double*)malloc(total_size * sizeof(double));
-    double* E = (double*)malloc(total_size * sizeof(double));
-    double* rho_new = (double*)malloc(total_size * sizeof(double));
-    double* rhou_new = (double*)malloc(total_size * sizeof(double));
-    double* rhov_new = (double*)malloc(total_size * sizeof(double));
-    double* E_new = (double*)malloc(total_size * sizeof(double));
+// ------------------------------------------------------------
+// Simulation state: the flat field arrays (with ghost cells), indexed i*(Ny+2)+j
+// ------------------------------------------------------------
+struct Simulation {
+    double *rho, *rhou, *rhov, *E;
+    double *rho_new, *rhou_new, *rhov_new, *E_new;
+    bool* solid;
+    bool ghosts_current;        // ghost cells already hold the boundary values of the current fields
+    // Optional primitive-variable cache of the current and the new fields, allocated by the
+    // first step that uses it
+    Primitives prim, prim_new;
+    bool primitives_current;    // prim holds the primitives of the current fields
+};
 
-    // Boolean mask for solid cells
-    bool* solid = (bool*)malloc(total_size * sizeof(bool));
+// ------------------------------------------------------------
+// Allocate the fields and set the free-stream state and the cylinder
+// ------------------------------------------------------------
+Simulation make_simulation() {
+    Simulation s;
+    s.ghosts_current = false;
+    s.prim = s.prim_new = Primitives{nullptr, nullptr, nullptr, nullptr};
+    s.primitives_current = false;
 
-    // Remember to initialize if needed
-    for (int i = 0; i < total_size; i++) {
-      rho[i] = 0.0;
-      rhou[i] = 0.0;
-      rhov[i] = 0.0;
-      E[i] = 0.0;
-      rho_new[i] = 0.0;
-      rhou_new[i] = 0.0;
-      rhov_new[i] = 0.0;
-      E_new[i] = 0.0;
-      solid[i] = false;
+    // Create flat arrays (with ghost cells)
+    double** fields[8] = {&s.rho, &s.rhou, &s.rhov, &s.E, &s.rho_new, &s.rhou_new, &s.rhov_new, &s.E_new};
+    for (double** field : fields) {
+        *field = (double*)malloc(total_size * sizeof(double));
+        for (int i = 0; i < total_size; i++) (*field)[i] = 0.0;
     }
 
+    // Boolean mask for solid cells
+    s.solid = (bool*)malloc(total_size * sizeof(bool));
+
     // ----- Obstacle (cylinder) parameters -----
     const double cx = 0.5;      // Cylinder center x
     const double cy = 0.5;      // Cylinder center y
     const double radius = 0.1;  // Cylinder radius
 
-    // ----- Free-stream initial conditions (inflow) -----
-    const double rho0 = 1.0;
-    const double u0 = 1.0;
-    const double v0 = 0.0;
-    const double p0 = 1.0;
-    const double E0 = p0/(gamma_val - 1.0) + 0.5*rho0*(u0*u0 + v0*v0);
-
     // ----- Initialize grid and obstacle mask -----
     for (int i = 0; i < Nx+2; i++){
         for (int j = 0; j < Ny+2; j++){
@@ -111,121 +129,210 @@ int main(){
             double y = (j - 0.5) * dy;
             // Mark cell as solid if inside the cylinder
             if ((x - cx)*(x - cx) + (y - cy)*(y - cy) <= radius * radius) {
-                solid[i*(Ny+2)+j] = true;
+                s.solid[i*(Ny+2)+j] = true;
                 // For a wall, we set zero velocity
-                rho[i*(Ny+2)+j] = rho0;
-                rhou[i*(Ny+2)+j] = 0.0;
-                rhov[i*(Ny+2)+j] = 0.0;
-                E[i*(Ny+2)+j] = p0/(gamma_val - 1.0);
+                s.rho[i*(Ny+2)+j] = rho0;
+                s.rhou[i*(Ny+2)+j] = 0.0;
+                s.rhov[i*(Ny+2)+j] = 0.0;
+                s.E[i*(Ny+2)+j] = p0/(gamma_val - 1.0);
             } else {
-                solid[i*(Ny+2)+j] = false;
-                rho[i*(Ny+2)+j] = rho0;
-                rhou[i*(Ny+2)+j] = rho0 * u0;
-                rhov[i*(Ny+2)+j] = rho0 * v0;
-                E[i*(Ny+2)+j] = E0;
+                s.solid[i*(Ny+2)+j] = false;
+                s.rho[i*(Ny+2)+j] = rho0;
+                s.rhou[i*(Ny+2)+j] = rho0 * u0;
+                s.rhov[i*(Ny+2)+j] = rho0 * v0;
+                s.E[i*(Ny+2)+j] = E0;
             }
         }
     }
+    return s;
+}
 
-    // ----- Determine time step from CFL condition -----
-    double c0 = sqrt(gamma_val * p0 / rho0);
-    double dt = CFL * min(dx, dy) / (fabs(u0) + c0)/2.0;
+void free_simulation(Simulation& s) {
+    double* fields[8] = {s.rho, s.rhou, s.rhov, s.E, s.rho_new, s.rhou_new, s.rhov_new, s.E_new};
+    for (double* field : fields) free(field);
+    free(s.solid);
+    for (Primitives* q : {&s.prim, &s.prim_new}) {
+        double* arrays[4] = {q->u, q->v, q->p, q->c2};
+        for (double* array : arrays) free(array);
+    }
+}
 
-    // ----- Time stepping parameters -----
-    const int nSteps = 2000;
+// ------------------------------------------------------------
+// Lax-Friedrichs update of the interior cells of rows i_begin <= i < i_end from the current
+// fields into the *_new fields
+// ------------------------------------------------------------
+void update_rows(const Simulation& s, int i_begin, int i_end) {
+    const double *rho = s.rho, *rhou = s.rhou, *rhov = s.rhov, *E = s.E;
+    double *rho_new = s.rho_new, *rhou_new = s.rhou_new, *rhov_new = s.rhov_new, *E_new = s.E_new;
+    const bool* solid = s.solid;
 
-    // ----- Main time-stepping loop -----
-    for (int n = 0; n < nSteps; n++){
-        // --- Apply boundary conditions on ghost cells ---
-        // Left boundary (inflow): fixed free-stream state
+    for (int i = i_begin; i < i_end; i++){
+        for (int j = 1; j <= Ny; j++){
+            // If the cell is inside the solid obstacle, do not update it
+            if (solid[i*(Ny+2)+j]) {
+                rho_new[i*(Ny+2)+j] = rho[i*(Ny+2)+j];
+                rhou_new[i*(Ny+2)+j] = rhou[i*(Ny+2)+j];
+                rhov_new[i*(Ny+2)+j] = rhov[i*(Ny+2)+j];
+                E_new[i*(Ny+2)+j] = E[i*(Ny+2)+j];
+                continue;
+            }
+
+            // Neighbour states, loaded once: the stores into the *_new arrays below could alias
+            // them as far as the compiler knows, which would force reloads for the fluxes
+            const int c = i*(Ny+2)+j, e = (i+1)*(Ny+2)+j, w = (i-1)*(Ny+2)+j, n = i*(Ny+2)+(j+1), so = i*(Ny+2)+(j-1);
+            const double rho_e = rho[e], rhou_e = rhou[e], rhov_e = rhov[e], E_e = E[e];
+            const double rho_w = rho[w], rhou_w = rhou[w], rhov_w = rhov[w], E_w = E[w];
+            const double rho_n = rho[n], rhou_n = rhou[n], rhov_n = rhov[n], E_n = E[n];
+            const double rho_s = rho[so], rhou_s = rhou[so], rhov_s = rhov[so], E_s = E[so];
+
+            // Compute fluxes
+            double fx_rho1, fx_rhou1, fx_rhov1, fx_E1;
+            double fx_rho2, fx_rhou2, fx_rhov2, fx_E2;
+            double fy_rho1, fy_rhou1, fy_rhov1, fy_E1;
+            double fy_rho2, fy_rhou2, fy_rhov2, fy_E2;
+
+            fluxX(rho_e, rhou_e, rhov_e, E_e, fx_rho1, fx_rhou1, fx_rhov1, fx_E1);
+            fluxX(rho_w, rhou_w, rhov_w, E_w, fx_rho2, fx_rhou2, fx_rhov2, fx_E2);
+            fluxY(rho_n, rhou_n, rhov_n, E_n, fy_rho1, fy_rhou1, fy_rhov1, fy_E1);
+            fluxY(rho_s, rhou_s, rhov_s, E_s, fy_rho2, fy_rhou2, fy_rhov2, fy_E2);
+
+            // Lax averaging of the four neighboring cells minus the flux differences
+            double dtdx = dt / (2 * dx);
+            double dtdy = dt / (2 * dy);
+
+            rho_new[c] = 0.25 * (rho_e + rho_w + rho_n + rho_s) - (dtdx * (fx_rho1 - fx_rho2) + dtdy * (fy_rho1 - fy_rho2));
+            rhou_new[c] = 0.25 * (rhou_e + rhou_w + rhou_n + rhou_s) - (dtdx * (fx_rhou1 - fx_rhou2) + dtdy * (fy_rhou1 - fy_rhou2));
+            rhov_new[c] = 0.25 * (rhov_e + rhov_w + rhov_n + rhov_s) - (dtdx * (fx_rhov1 - fx_rhov2) + dtdy * (fy_rhov1 - fy_rhov2));
+            E_new[c] = 0.25 * (E_e + E_w + E_n + E_s) - (dtdx * (fx_E1 - fx_E2) + dtdy * (fy_E1 - fy_E2));
+        }
+    }
+}
+
+// ------------------------------------------------------------
+// Apply the boundary conditions to the ghost cells of the current fields
+// ------------------------------------------------------------
+void apply_boundary_conditions(Simulation& s) {
+    double *rho = s.rho, *rhou = s.rhou, *rhov = s.rhov, *E = s.E;
+
+    // Left boundary (inflow): fixed free-stream state
+    for (int j = 0; j < Ny+2; j++){
+        rho[0*(Ny+2)+j] = rho0;
+        rhou[0*(Ny+2)+j] = rho0*u0;
+        rhov[0*(Ny+2)+j] = rho0*v0;
+        E[0*(Ny+2)+j] = E0;
+    }
+    // Right boundary (outflow): copy from the interior
+    for (int j = 0; j < Ny+2; j++){
+        rho[(Nx+1)*(Ny+2)+j] = rho[Nx*(Ny+2)+j];
+        rhou[(Nx+1)*(Ny+2)+j] = rhou[Nx*(Ny+2)+j];
+        rhov[(Nx+1)*(Ny+2)+j] = rhov[Nx*(Ny+2)+j];
+        E[(Nx+1)*(Ny+2)+j] = E[Nx*(Ny+2)+j];
+    }
+    // Bottom boundary: reflective
+    for (int i = 0; i < Nx+2; i++){
+        rho[i*(Ny+2)+0] = rho[i*(Ny+2)+1];
+        rhou[i*(Ny+2)+0] = rhou[i*(Ny+2)+1];
+        rhov[i*(Ny+2)+0] = -rhov[i*(Ny+2)+1];
+        E[i*(Ny+2)+0] = E[i*(Ny+2)+1];
+    }
+    // Top boundary: reflective
+    for (int i = 0; i < Nx+2; i++){
+        rho[i*(Ny+2)+(Ny+1)] = rho[i*(Ny+2)+Ny];
+        rhou[i*(Ny+2)+(Ny+1)] = rhou[i*(Ny+2)+Ny];
+        rhov[i*(Ny+2)+(Ny+1)] = -rhov[i*(Ny+2)+Ny];
+        E[i*(Ny+2)+(Ny+1)] = E[i*(Ny+2)+Ny];
+    }
+}
+
+// ------------------------------------------------------------
+// One time step on a single core: boundary conditions, Lax-Friedrichs update, copy back and
+// the kinetic-energy sum. Returns the total kinetic energy.
+// ------------------------------------------------------------
+double step_serial(Simulation& s) {
+    double *rho = s.rho, *rhou = s.rhou, *rhov = s.rhov, *E = s.E;
+    const double *rho_new = s.rho_new, *rhou_new = s.rhou_new, *rhov_new = s.rhov_new, *E_new = s.E_new;
+
+    // --- Apply boundary conditions on ghost cells ---
+    apply_boundary_conditions(s);
+
+    // --- Update interior cells using a Lax-Friedrichs scheme ---
+    update_rows(s, 1, Nx+1);
+
+    // Copy updated values back
+    for (int i = 1; i <= Nx; i++){
+        // Row by row, so each array is a plain contiguous copy
+        copy(rho_new + i*(Ny+2)+1, rho_new + i*(Ny+2)+Ny+1, rho + i*(Ny+2)+1);
+        copy(rhou_new + i*(Ny+2)+1, rhou_new + i*(Ny+2)+Ny+1, rhou + i*(Ny+2)+1);
+        copy(rhov_new + i*(Ny+2)+1, rhov_new + i*(Ny+2)+Ny+1, rhov + i*(Ny+2)+1);
+        copy(E_new + i*(Ny+2)+1, E_new + i*(Ny+2)+Ny+1, E + i*(Ny+2)+1);
+    }
+
+    // Calculate total kinetic energy
+    double total_kinetic = 0.0;
+    for (int i = 1; i <= Nx; i++) {
+        for (int j = 1; j <= Ny; j++) {
+            double u = rhou[i*(Ny+2)+j] / rho[i*(Ny+2)+j];
+            double v = rhov[i*(Ny+2)+j] / rho[i*(Ny+2)+j];
+            total_kinetic += 0.5 * rho[i*(Ny+2)+j] * (u * u + v * v);
+        }
+    }
+    return total_kinetic;
+}
+
+// ------------------------------------------------------------
+// The same time step with all four phases multithreaded. Every phase splits the rows (i) into
+// one contiguous block per thread, so a thread's update, copy and kinetic-energy passes touch
+// the rows it just wrote and only the block edges are shared. Cells are updated with the same
+// arithmetic as step_serial; only the kinetic-energy reduction order differs.
+// ------------------------------------------------------------
+double step_omp(Simulation& s) {
+    double *rho = s.rho, *rhou = s.rhou, *rhov = s.rhov, *E = s.E;
+    const double *rho_new = s.rho_new, *rhou_new = s.rhou_new, *rhov_new = s.rhov_new, *E_new = s.E_new;
+
+    double total_kinetic = 0.0;
+    #pragma omp parallel
+    {
+        // Left and right boundaries first: the bottom/top pass copies their corner cells
+        #pragma omp for schedule(static)
         for (int j = 0; j < Ny+2; j++){
             rho[0*(Ny+2)+j] = rho0;
             rhou[0*(Ny+2)+j] = rho0*u0;
             rhov[0*(Ny+2)+j] = rho0*v0;
             E[0*(Ny+2)+j] = E0;
-        }
-        // Right boundary (outflow): copy from the interior
-        for (int j = 0; j < Ny+2; j++){
             rho[(Nx+1)*(Ny+2)+j] = rho[Nx*(Ny+2)+j];
             rhou[(Nx+1)*(Ny+2)+j] = rhou[Nx*(Ny+2)+j];
             rhov[(Nx+1)*(Ny+2)+j] = rhov[Nx*(Ny+2)+j];
             E[(Nx+1)*(Ny+2)+j] = E[Nx*(Ny+2)+j];
         }
-        // Bottom boundary: reflective
+        #pragma omp for schedule(static)
         for (int i = 0; i < Nx+2; i++){
             rho[i*(Ny+2)+0] = rho[i*(Ny+2)+1];
             rhou[i*(Ny+2)+0] = rhou[i*(Ny+2)+1];
             rhov[i*(Ny+2)+0] = -rhov[i*(Ny+2)+1];
             E[i*(Ny+2)+0] = E[i*(Ny+2)+1];
-        }
-        // Top boundary: reflective
-        for (int i = 0; i < Nx+2; i++){
             rho[i*(Ny+2)+(Ny+1)] = rho[i*(Ny+2)+Ny];
             rhou[i*(Ny+2)+(Ny+1)] = rhou[i*(Ny+2)+Ny];
             rhov[i*(Ny+2)+(Ny+1)] = -rhov[i*(Ny+2)+Ny];
             E[i*(Ny+2)+(Ny+1)] = E[i*(Ny+2)+Ny];
         }
 
-        // --- Update interior cells using a Lax-Friedrichs scheme ---
+        #pragma omp for schedule(static)
         for (int i = 1; i <= Nx; i++){
-            for (int j = 1; j <= Ny; j++){
-                // If the cell is inside the solid obstacle, do not update it
-                if (solid[i*(Ny+2)+j]) {
-                    rho_new[i*(Ny+2)+j] = rho[i*(Ny+2)+j];
-                    rhou_new[i*(Ny+2)+j] = rhou[i*(Ny+2)+j];
-                    rhov_new[i*(Ny+2)+j] = rhov[i*(Ny+2)+j];
-                    E_new[i*(Ny+2)+j] = E[i*(Ny+2)+j];
-                    continue;
-                }
-
-                // Compute a Lax averaging of the four neighboring cells
-                rho_new[i*(Ny+2)+j] = 0.25 * (rho[(i+1)*(Ny+2)+j] + rho[(i-1)*(Ny+2)+j] + 
-                                             rho[i*(Ny+2)+(j+1)] + rho[i*(Ny+2)+(j-1)]);
-                rhou_new[i*(Ny+2)+j] = 0.25 * (rhou[(i+1)*(Ny+2)+j] + rhou[(i-1)*(Ny+2)+j] + 
-                                              rhou[i*(Ny+2)+(j+1)] + rhou[i*(Ny+2)+(j-1)]);
-                rhov_new[i*(Ny+2)+j] = 0.25 * (rhov[(i+1)*(Ny+2)+j] + rhov[(i-1)*(Ny+2)+j] + 
-                                              rhov[i*(Ny+2)+(j+1)] + rhov[i*(Ny+2)+(j-1)]);
-                E_new[i*(Ny+2)+j] = 0.25 * (E[(i+1)*(Ny+2)+j] + E[(i-1)*(Ny+2)+j] + 
-                                           E[i*(Ny+2)+(j+1)] + E[i*(Ny+2)+(j-1)]);
-
-                // Compute fluxes
-                double fx_rho1, fx_rhou1, fx_rhov1, fx_E1;
-                double fx_rho2, fx_rhou2, fx_rhov2, fx_E2;
-                double fy_rho1, fy_rhou1, fy_rhov1, fy_E1;
-                double fy_rho2, fy_rhou2, fy_rhov2, fy_E2;
-
-                fluxX(rho[(i+1)*(Ny+2)+j], rhou[(i+1)*(Ny+2)+j], rhov[(i+1)*(Ny+2)+j], E[(i+1)*(Ny+2)+j],
-                      fx_rho1, fx_rhou1, fx_rhov1, fx_E1);
-                fluxX(rho[(i-1)*(Ny+2)+j], rhou[(i-1)*(Ny+2)+j], rhov[(i-1)*(Ny+2)+j], E[(i-1)*(Ny+2)+j],
-                      fx_rho2, fx_rhou2, fx_rhov2, fx_E2);
-                fluxY(rho[i*(Ny+2)+(j+1)], rhou[i*(Ny+2)+(j+1)], rhov[i*(Ny+2)+(j+1)], E[i*(Ny+2)+(j+1)],
-                      fy_rho1, fy_rhou1, fy_rhov1, fy_E1);
-                fluxY(rho[i*(Ny+2)+(j-1)], rhou[i*(Ny+2)+(j-1)], rhov[i*(Ny+2)+(j-1)], E[i*(Ny+2)+(j-1)],
-                      fy_rho2, fy_rhou2, fy_rhov2, fy_E2);
-
-                // Apply flux differences
-                double dtdx = dt / (2 * dx);
-                double dtdy = dt / (2 * dy);
-                
-                rho_new[i*(Ny+2)+j] -= dtdx * (fx_rho1 - fx_rho2) + dtdy * (fy_rho1 - fy_rho2);
-                rhou_new[i*(Ny+2)+j] -= dtdx * (fx_rhou1 - fx_rhou2) + dtdy * (fy_rhou1 - fy_rhou2);
-                rhov_new[i*(Ny+2)+j] -= dtdx * (fx_rhov1 - fx_rhov2) + dtdy * (fy_rhov1 - fy_rhov2);
-                E_new[i*(Ny+2)+j] -= dtdx * (fx_E1 - fx_E2) + dtdy * (fy_E1 - fy_E2);
-            }
+            update_rows(s, i, i+1);
         }
 
-        // Copy updated values back
+        // Same static partition as the kinetic-energy loop below, so each thread only reads
+        // back rows it copied itself and the barrier between the two can be skipped
+        #pragma omp for schedule(static) nowait
         for (int i = 1; i <= Nx; i++){
-            for (int j = 1; j <= Ny; j++){
-                rho[i*(Ny+2)+j] = rho_new[i*(Ny+2)+j];
-                rhou[i*(Ny+2)+j] = rhou_new[i*(Ny+2)+j];
-                rhov[i*(Ny+2)+j] = rhov_new[i*(Ny+2)+j];
-                E[i*(Ny+2)+j] = E_new[i*(Ny+2)+j];
-            }
+            // Row by row, so each array is a plain contiguous copy
+            copy(rho_new + i*(Ny+2)+1, rho_new + i*(Ny+2)+Ny+1, rho + i*(Ny+2)+1);
+            copy(rhou_new + i*(Ny+2)+1, rhou_new + i*(Ny+2)+Ny+1, rhou + i*(Ny+2)+1);
+            copy(rhov_new + i*(Ny+2)+1, rhov_new + i*(Ny+2)+Ny+1, rhov + i*(Ny+2)+1);
+            copy(E_new + i*(Ny+2)+1, E_new + i*(Ny+2)+Ny+1, E + i*(Ny+2)+1);
         }
 
-        // Calculate total kinetic energy
-        double total_kinetic = 0.0;
+        #pragma omp for schedule(static) reduction(+:total_kinetic)
         for (int i = 1; i <= Nx; i++) {
             for (int j = 1; j <= Ny; j++) {
                 double u = rhou[i*(Ny+2)+j] / rho[i*(Ny+2)+j];
@@ -233,13 +340,463 @@ int main(){
                 total_kinetic += 0.5 * rho[i*(Ny+2)+j] * (u * u + v * v);
             }
         }
+    }
+    return total_kinetic;
+}
+
+// ------------------------------------------------------------
+// Write the ghost cells of the new state next to row i: the inflow column with the first row,
+// the outflow column with the last, corners included. The values are what the boundary
+// conditions at the start of the next step would set.
+// ------------------------------------------------------------
+void write_row_ghosts(const Simulation& s, int i) {
+    double *rho = s.rho_new, *rhou = s.rhou_new, *rhov = s.rhov_new, *E = s.E_new;
 
+    // Bottom and top: reflective
+    rho[i*(Ny+2)+0] = rho[i*(Ny+2)+1];
+    rhou[i*(Ny+2)+0] = rhou[i*(Ny+2)+1];
+    rhov[i*(Ny+2)+0] = -rhov[i*(Ny+2)+1];
+    E[i*(Ny+2)+0] = E[i*(Ny+2)+1];
+    rho[i*(Ny+2)+(Ny+1)] = rho[i*(Ny+2)+Ny];
+    rhou[i*(Ny+2)+(Ny+1)] = rhou[i*(Ny+2)+Ny];
+    rhov[i*(Ny+2)+(Ny+1)] = -rhov[i*(Ny+2)+Ny];
+    E[i*(Ny+2)+(Ny+1)] = E[i*(Ny+2)+Ny];
+    if (i == 1) {
+        for (int j = 0; j < Ny+2; j++){
+            rho[0*(Ny+2)+j] = rho0;
+            rhou[0*(Ny+2)+j] = rho0*u0;
+            rhov[0*(Ny+2)+j] = (j == 0 || j == Ny+1) ? -(rho0*v0) : rho0*v0;
+            E[0*(Ny+2)+j] = E0;
+        }
+    }
+    if (i == Nx) {
+        for (int j = 0; j < Ny+2; j++){
+            rho[(Nx+1)*(Ny+2)+j] = rho[Nx*(Ny+2)+j];
+            rhou[(Nx+1)*(Ny+2)+j] = rhou[Nx*(Ny+2)+j];
+            rhov[(Nx+1)*(Ny+2)+j] = rhov[Nx*(Ny+2)+j];
+            E[(Nx+1)*(Ny+2)+j] = E[Nx*(Ny+2)+j];
+        }
+    }
+}
+
+// Ghost cells of the new state next to row i, then the row's kinetic energy added to
+// total_kinetic cell by cell, in the order step_serial sums it
+void finish_row(const Simulation& s, int i, double& total_kinetic) {
+    const double *rho = s.rho_new, *rhou = s.rhou_new, *rhov = s.rhov_new;
+    write_row_ghosts(s, i);
+    for (int j = 1; j <= Ny; j++) {
+        double u = rhou[i*(Ny+2)+j] / rho[i*(Ny+2)+j];
+        double v = rhov[i*(Ny+2)+j] / rho[i*(Ny+2)+j];
+        total_kinetic += 0.5 * rho[i*(Ny+2)+j] * (u * u + v * v);
+    }
+}
+
+// The new fields become the current ones, ghosts included
+void swap_buffers(Simulation& s) {
+    swap(s.rho, s.rho_new);
+    swap(s.rhou, s.rhou_new);
+    swap(s.rhov, s.rhov_new);
+    swap(s.E, s.E_new);
+    s.ghosts_current = true;
+    s.primitives_current = false;
+}
+
+// ------------------------------------------------------------
+// Fused time step: one pass over the rows that updates the interior into the *_new fields,
+// writes the ghost cells of the new state next to the row, and adds the row's kinetic energy
+// while it is still in cache; then the current and new buffers are swapped instead of copied.
+// Per interior cell that is 4 reads and 4 writes of the conserved fields, against 19 for
+// update + copy + kinetic-energy pass.
+// ------------------------------------------------------------
+double step_fused(Simulation& s) {
+    if (!s.ghosts_current) apply_boundary_conditions(s);
+    double total_kinetic = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:total_kinetic)
+    for (int i = 1; i <= Nx; i++){
+        update_rows(s, i, i+1);
+        finish_row(s, i, total_kinetic);
+    }
+    swap_buffers(s);
+    return total_kinetic;
+}
+
+// ------------------------------------------------------------
+// Fluxes of every cell of one row (ghosts included), in x and in y
+// ------------------------------------------------------------
+struct RowFluxes {
+    double x[4][Ny+2];          // fluxX components: rho, rhou, rhov, E
+    double y[4][Ny+2];          // fluxY components
+};
+
+// Both fluxes of each cell of row k from one pressure evaluation; the arithmetic is that of
+// fluxX and fluxY, so the values are the same
+void compute_row_fluxes(const Simulation& s, int k, RowFluxes& f) {
+    const double *rho = s.rho + k*(Ny+2), *rhou = s.rhou + k*(Ny+2), *rhov = s.rhov + k*(Ny+2), *E = s.E + k*(Ny+2);
+    for (int j = 0; j < Ny+2; j++){
+        double u = rhou[j] / rho[j];
+        double v = rhov[j] / rho[j];
+        double p = pressure(rho[j], rhou[j], rhov[j], E[j]);
+        f.x[0][j] = rhou[j];
+        f.x[1][j] = rhou[j] * u + p;
+        f.x[2][j] = rhov[j] * u;
+        f.x[3][j] = (E[j] + p) * u;
+        f.y[0][j] = rhov[j];
+        f.y[1][j] = rhou[j] * v;
+        f.y[2][j] = rhov[j] * v + p;
+        f.y[3][j] = (E[j] + p) * v;
+    }
+}
+
+// Lax-Friedrichs update of row i from the precomputed fluxes of rows i-1, i and i+1
+void update_row_from_fluxes(const Simulation& s, int i, const RowFluxes& west, const RowFluxes& centre, const RowFluxes& east) {
+    const double *rho = s.rho, *rhou = s.rhou, *rhov = s.rhov, *E = s.E;
+    double *rho_new = s.rho_new, *rhou_new = s.rhou_new, *rhov_new = s.rhov_new, *E_new = s.E_new;
+    const bool* solid = s.solid;
+    const double dtdx = dt / (2 * dx);
+    const double dtdy = dt / (2 * dy);
+
+    for (int j = 1; j <= Ny; j++){
+        const int c = i*(Ny+2)+j, e = (i+1)*(Ny+2)+j, w = (i-1)*(Ny+2)+j, n = i*(Ny+2)+(j+1), so = i*(Ny+2)+(j-1);
+        if (solid[c]) {
+            rho_new[c] = rho[c];
+            rhou_new[c] = rhou[c];
+            rhov_new[c] = rhov[c];
+            E_new[c] = E[c];
+            continue;
+        }
+        rho_new[c] = 0.25 * (rho[e] + rho[w] + rho[n] + rho[so]) -
+                     (dtdx * (east.x[0][j] - west.x[0][j]) + dtdy * (centre.y[0][j+1] - centre.y[0][j-1]));
+        rhou_new[c] = 0.25 * (rhou[e] + rhou[w] + rhou[n] + rhou[so]) -
+                      (dtdx * (east.x[1][j] - west.x[1][j]) + dtdy * (centre.y[1][j+1] - centre.y[1][j-1]));
+        rhov_new[c] = 0.25 * (rhov[e] + rhov[w] + rhov[n] + rhov[so]) -
+                      (dtdx * (east.x[2][j] - west.x[2][j]) + dtdy * (centre.y[2][j+1] - centre.y[2][j-1]));
+        E_new[c] = 0.25 * (E[e] + E[w] + E[n] + E[so]) -
+                   (dtdx * (east.x[3][j] - west.x[3][j]) + dtdy * (centre.y[3][j+1] - centre.y[3][j-1]));
+    }
+}
+
+// Fluxes of one row into a window buffer, and the per-row work once a row has been updated
+typedef void (*RowFluxFunction)(const Simulation&, int, RowFluxes&);
+typedef void (*FinishRowFunction)(const Simulation&, int, double&);
+
+// ------------------------------------------------------------
+// Fused update of all rows with the fluxes computed once per cell. Each thread walks a block
+// of rows with a window of three rows of fluxes: entering row i only computes the fluxes of
+// row i+1. Returns the kinetic energy accumulated by finish; the buffers are not swapped.
+// ------------------------------------------------------------
+double update_with_flux_window(const Simulation& s, RowFluxFunction row_fluxes, FinishRowFunction finish) {
+    double total_kinetic = 0.0;
+    #pragma omp parallel reduction(+:total_kinetic)
+    {
+        // Contiguous blocks of rows, one per thread
+        const int nthreads = omp_get_num_threads(), t = omp_get_thread_num();
+        const int i_begin = 1 + Nx * t / nthreads, i_end = 1 + Nx * (t + 1) / nthreads;
+        if (i_begin < i_end) {
+            RowFluxes window[3];
+            RowFluxes *west = &window[0], *centre = &window[1], *east = &window[2];
+            row_fluxes(s, i_begin - 1, *west);
+            row_fluxes(s, i_begin, *centre);
+            for (int i = i_begin; i < i_end; i++){
+                row_fluxes(s, i + 1, *east);
+                update_row_from_fluxes(s, i, *west, *centre, *east);
+                finish(s, i, total_kinetic);
+                RowFluxes* oldest = west;
+                west = centre;
+                centre = east;
+                east = oldest;
+            }
+        }
+    }
+    return total_kinetic;
+}
+
+// ------------------------------------------------------------
+// Fused time step with the fluxes computed once per cell. update_rows evaluates fluxX on the
+// east and west neighbours and fluxY on the north and south ones, so every cell's fluxes are
+// computed twice and its pressure four times; here they are computed once, with one pressure
+// per cell. Apart from the two rows that prime each thread's window, that is half the flux
+// work and a quarter of the pressure work, with the same results.
+// ------------------------------------------------------------
+double step_faces(Simulation& s) {
+    if (!s.ghosts_current) apply_boundary_conditions(s);
+    double total_kinetic = update_with_flux_window(s, compute_row_fluxes, finish_row);
+    swap_buffers(s);
+    return total_kinetic;
+}
+
+// ------------------------------------------------------------
+// Primitive variables of the cells [begin, end) of the given fields. The only division is 1/rho.
+// ------------------------------------------------------------
+void compute_primitives(const double* rho, const double* rhou, const double* rhov, const double* E,
+                        const Primitives& q, int begin, int end) {
+    // The eight arrays never overlap, which is more than the compiler's aliasing checks cover
+    #pragma omp simd
+    for (int k = begin; k < end; k++){
+        double inv_rho = 1.0 / rho[k];
+        double u = rhou[k] * inv_rho;
+        double v = rhov[k] * inv_rho;
+        double p = (gamma_val - 1.0) * (E[k] - 0.5 * rho[k] * (u * u + v * v));
+        q.u[k] = u;
+        q.v[k] = v;
+        q.p[k] = p;
+        q.c2[k] = gamma_val * p * inv_rho;
+    }
+}
+
+// Both fluxes of each cell of row k from the cached primitives of the current fields
+void compute_row_fluxes_from_primitives(const Simulation& s, int k, RowFluxes& f) {
+    const double *rhou = s.rhou + k*(Ny+2), *rhov = s.rhov + k*(Ny+2), *E = s.E + k*(Ny+2);
+    const double *u = s.prim.u + k*(Ny+2), *v = s.prim.v + k*(Ny+2), *p = s.prim.p + k*(Ny+2);
+    for (int j = 0; j < Ny+2; j++){
+        f.x[0][j] = rhou[j];
+        f.x[1][j] = rhou[j] * u[j] + p[j];
+        f.x[2][j] = rhov[j] * u[j];
+        f.x[3][j] = (E[j] + p[j]) * u[j];
+        f.y[0][j] = rhov[j];
+        f.y[1][j] = rhou[j] * v[j];
+        f.y[2][j] = rhov[j] * v[j] + p[j];
+        f.y[3][j] = (E[j] + p[j]) * v[j];
+    }
+}
+
+// Ghost cells of the new state next to row i, the primitives of the new row (and of the
+// boundary column written with it), and the row's kinetic energy from those primitives
+void finish_row_primitives(const Simulation& s, int i, double& total_kinetic) {
+    write_row_ghosts(s, i);
+    compute_primitives(s.rho_new, s.rhou_new, s.rhov_new, s.E_new, s.prim_new, i*(Ny+2), (i+1)*(Ny+2));
+    if (i == 1) compute_primitives(s.rho_new, s.rhou_new, s.rhov_new, s.E_new, s.prim_new, 0, Ny+2);
+    if (i == Nx) compute_primitives(s.rho_new, s.rhou_new, s.rhov_new, s.E_new, s.prim_new, (Nx+1)*(Ny+2), (Nx+2)*(Ny+2));
+
+    const double *rho = s.rho_new, *u = s.prim_new.u, *v = s.prim_new.v;
+    for (int j = 1; j <= Ny; j++) {
+        const int c = i*(Ny+2)+j;
+        total_kinetic += 0.5 * rho[c] * (u[c] * u[c] + v[c] * v[c]);
+    }
+}
+
+// ------------------------------------------------------------
+// Fused time step on cached primitive variables. u, v, p and the squared sound speed are
+// computed once per cell per step from a single division, 1/rho, while the new row is still
+// in cache; the next step's fluxes and the diagnostics read them instead of dividing again.
+// Agrees with the other engines to rounding only: rhou * (1/rho) is not rounded like rhou / rho.
+// The cache costs four more arrays of memory traffic per step, so whether it beats faces
+// depends on how slow division is against memory; the divisions variant measures both.
+// ------------------------------------------------------------
+double step_primitive(Simulation& s) {
+    if (s.prim.u == nullptr) {
+        for (Primitives* q : {&s.prim, &s.prim_new}) {
+            double** arrays[4] = {&q->u, &q->v, &q->p, &q->c2};
+            for (double** array : arrays) *array = (double*)malloc(total_size * sizeof(double));
+        }
+    }
+    if (!s.ghosts_current) apply_boundary_conditions(s);
+    if (!s.primitives_current) compute_primitives(s.rho, s.rhou, s.rhov, s.E, s.prim, 0, total_size);
+
+    double total_kinetic = update_with_flux_window(s, compute_row_fluxes_from_primitives, finish_row_primitives);
+    swap_buffers(s);
+    swap(s.prim, s.prim_new);
+    s.primitives_current = true;
+    return total_kinetic;
+}
+
+// Largest CFL number dt * max((|u| + c) / dx, (|v| + c) / dy) over the fluid cells, from the
+// cached primitives of the current fields
+double max_cfl_number(const Simulation& s) {
+    double cfl = 0.0;
+    for (int i = 1; i <= Nx; i++) {
+        for (int j = 1; j <= Ny; j++) {
+            const int k = i*(Ny+2)+j;
+            if (s.solid[k]) continue;
+            const double c = sqrt(s.prim.c2[k]);
+            cfl = max(cfl, dt * max((fabs(s.prim.u[k]) + c) / dx, (fabs(s.prim.v[k]) + c) / dy));
+        }
+    }
+    return cfl;
+}
+
+typedef double (*StepFunction)(Simulation&);
+
+// ------------------------------------------------------------
+// Run nSteps steps, printing the kinetic energy every 50 steps when verbose. Returns the
+// final kinetic energy.
+// ------------------------------------------------------------
+double simulate(Simulation& s, StepFunction step, int nSteps, bool verbose) {
+    double total_kinetic = 0.0;
+    for (int n = 0; n < nSteps; n++){
+        total_kinetic = step(s);
         // Optional: output progress and write VTK file every 50 time steps
-        if (n % 50 == 0) {
+        if (verbose && n % 50 == 0) {
             cout << "Step " << n << " completed, total kinetic energy: " << total_kinetic << endl;
         }
     }
+    return total_kinetic;
+}
 
-    return 0;
+// Largest difference between the conserved fields of two runs over the interior cells (the
+// engines refresh the ghost cells at different points of the step)
+double max_field_difference(const Simulation& a, const Simulation& b) {
+    double diff = 0.0;
+    for (int i = 1; i <= Nx; i++) {
+        for (int j = 1; j <= Ny; j++) {
+            const int k = i*(Ny+2)+j;
+            diff = max(diff, fabs(a.rho[k] - b.rho[k]));
+            diff = max(diff, fabs(a.rhou[k] - b.rhou[k]));
+            diff = max(diff, fabs(a.rhov[k] - b.rhov[k]));
+            diff = max(diff, fabs(a.E[k] - b.E[k]));
+        }
+    }
+    return diff;
+}
+
+// ------------------------------------------------------------
+// Runs a step engine at 1, 2, 4, ... threads up to the maximum and compares every run with
+// the serial reference: field difference, kinetic-energy difference, time and speedup
+// ------------------------------------------------------------
+void scaling_report(const string& name, StepFunction step, int nSteps) {
+    Simulation reference = make_simulation();
+    auto t1 = chrono::high_resolution_clock::now();
+    double reference_kinetic = simulate(reference, step_serial, nSteps, false);
+    auto t2 = chrono::high_resolution_clock::now();
+    double serial_ms = chrono::duration<double, milli>(t2 - t1).count();
+    cout << "serial: " << serial_ms << " ms, final kinetic energy " << setprecision(15) << reference_kinetic << setprecision(6) << endl;
+
+    const int max_threads = omp_get_max_threads();
+    vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+    for (int threads : thread_counts) {
+        omp_set_num_threads(threads);
+        Simulation s = make_simulation();
+        auto t3 = chrono::high_resolution_clock::now();
+        double kinetic = simulate(s, step, nSteps, false);
+        auto t4 = chrono::high_resolution_clock::now();
+        double ms = chrono::duration<double, milli>(t4 - t3).count();
+        cout << name << " " << threads << " threads: " << ms << " ms, speedup " << serial_ms / ms
+             << ", max field difference " << max_field_difference(s, reference)
+             << ", kinetic energy difference " << fabs(kinetic - reference_kinetic) / reference_kinetic << " (relative)" << endl;
+        free_simulation(s);
+    }
+    omp_set_num_threads(max_threads);
+    free_simulation(reference);
+}
+
+// ------------------------------------------------------------
+// Divisions one step of an engine performs once it is running, counted from the obstacle
+// mask and the thread count. The flux functions divide three times per evaluation (u, then u
+// and v again in pressure()), compute_row_fluxes four times per cell, the kinetic-energy sums
+// twice per interior cell, and the primitive engine once per cell and nowhere else.
+// ------------------------------------------------------------
+long long divisions_per_step(const string& name, const Simulation& s) {
+    const long long interior = (long long)Nx * Ny;
+    if (name == "primitive") return total_size;
+    if (name == "faces") {
+        // Each thread's window also computes the fluxes of the rows on either side of its block
+        const long long flux_rows = Nx + 2LL * min(omp_get_max_threads(), Nx);
+        return 4 * flux_rows * (Ny+2) + 2 * interior;
+    }
+    // update_rows: fluxX on the east and west and fluxY on the north and south neighbours of
+    // every fluid cell
+    long long fluid = 0;
+    for (int i = 1; i <= Nx; i++) {
+        for (int j = 1; j <= Ny; j++) {
+            if (!s.solid[i*(Ny+2)+j]) fluid++;
+        }
+    }
+    return 4 * 3 * fluid + 2 * interior;
 }
 
+// ------------------------------------------------------------
+// Runs serial, faces and primitive side by side and prints each engine's divisions and time
+// per step, the differences against serial and faces, and the field difference against
+// serial. The time is the best of three runs.
+// ------------------------------------------------------------
+void division_report(int nSteps) {
+    struct Run { const char* name; StepFunction step; long long divisions; double ms_per_step; };
+    Run runs[] = {{"serial", step_serial, 0, 0.0}, {"faces", step_faces, 0, 0.0}, {"primitive", step_primitive, 0, 0.0}};
+    Simulation reference = make_simulation();
+    simulate(reference, step_serial, nSteps, false);
+    for (Run& run : runs) {
+        run.ms_per_step = 1e30;
+        for (int repeat = 0; repeat < 3; repeat++) {
+            Simulation s = make_simulation();
+            auto t1 = chrono::high_resolution_clock::now();
+            simulate(s, run.step, nSteps, false);
+            auto t2 = chrono::high_resolution_clock::now();
+            run.ms_per_step = min(run.ms_per_step, chrono::duration<double, milli>(t2 - t1).count() / nSteps);
+            run.divisions = divisions_per_step(run.name, s);
+            if (repeat == 0) {
+                cout << run.name << ": " << run.divisions << " divisions per step, max field difference against serial "
+                     << max_field_difference(s, reference) << endl;
+            }
+            free_simulation(s);
+        }
+    }
+    free_simulation(reference);
+
+    const Run &serial = runs[0], &faces = runs[1];
+    for (const Run& run : runs) {
+        cout << run.name << ": " << run.ms_per_step << " ms per step";
+        for (const Run* base : {&serial, &faces}) {
+            if (base == &run) continue;
+            cout << ", " << run.ms_per_step - base->ms_per_step << " ms and " << run.divisions - base->divisions
+                 << " divisions per step against " << base->name;
+        }
+        cout << endl;
+    }
+}
+
+// ------------------------------------------------------------
+// Main simulation routine
+//
+// Usage: ./cfd_euler [variant]
+//   variant: serial (default), omp (all phases multithreaded), fused (single pass per step
+//            with buffer swapping), faces (fused, with each cell's fluxes computed once),
+//            primitive (faces on cached primitive variables), <engine>-scaling (the engine
+//            against serial over 1, 2, 4, ... threads), or divisions (divisions and time per
+//            step of serial, faces and primitive)
+// ------------------------------------------------------------
+int main(int argc, char** argv){
+    const string variant = argc > 1 ? argv[1] : "serial";
+
+    // ----- Time stepping parameters -----
+    const int nSteps = 2000;
+
+    if (variant == "divisions") {
+        division_report(nSteps);
+        return 0;
+    }
+
+    struct Engine { const char* name; StepFunction step; };
+    const Engine engines[] = {{"serial", step_serial}, {"omp", step_omp}, {"fused", step_fused},
+                              {"faces", step_faces}, {"primitive", step_primitive}};
+
+    const string suffix = "-scaling";
+    const bool scaling = variant.size() > suffix.size() &&
+                         variant.compare(variant.size() - suffix.size(), suffix.size(), suffix) == 0;
+    const string engine_name = scaling ? variant.substr(0, variant.size() - suffix.size()) : variant;
+    StepFunction step = nullptr;
+    for (const Engine& e : engines) {
+        if (engine_name == e.name) step = e.step;
+    }
+    if (step == nullptr) {
+        cerr << "Unknown variant " << variant << endl;
+        return 1;
+    }
+
+    if (scaling) {
+        scaling_report(engine_name, step, nSteps);
+        return 0;
+    }
+
+    Simulation s = make_simulation();
+    auto t1 = chrono::high_resolution_clock::now();
+    simulate(s, step, nSteps, true);
+    auto t2 = chrono::high_resolution_clock::now();
+    cout << "Simulation time: " << chrono::duration<double, milli>(t2 - t1).count() << " ms" << endl;
+    if (s.primitives_current) {
+        cout << "Max CFL number: " << max_cfl_number(s) << endl;
+    }
+    free_simulation(s);
+
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include <chrono>
 #include <omp.h>
 
@@ -40,6 +41,33 @@ void fluxY(double rho, double rhou, double rhov, double E,
     fE = (E + p) * v;
 }
 
+// New state of interior cell c after one Lax-Friedrichs step; solid cells keep their state
+void lax_friedrichs_cell(const double* rho, const double* rhou, const double* rhov, const double* E,
+                         const char* solid, int c, int stride, double dtdx, double dtdy,
+                         double& rho_c, double& rhou_c, double& rhov_c, double& E_c) {
+    if (solid[c]) {
+        rho_c = rho[c];
+        rhou_c = rhou[c];
+        rhov_c = rhov[c];
+        E_c = E[c];
+        return;
+    }
+    const int e = c + stride, w = c - stride, n = c + 1, s = c - 1;
+    double fx_rho1, fx_rhou1, fx_rhov1, fx_E1;
+    double fx_rho2, fx_rhou2, fx_rhov2, fx_E2;
+    double fy_rho1, fy_rhou1, fy_rhov1, fy_E1;
+    double fy_rho2, fy_rhou2, fy_rhov2, fy_E2;
+    fluxX(rho[e], rhou[e], rhov[e], E[e], fx_rho1, fx_rhou1, fx_rhov1, fx_E1);
+    fluxX(rho[w], rhou[w], rhov[w], E[w], fx_rho2, fx_rhou2, fx_rhov2, fx_E2);
+    fluxY(rho[n], rhou[n], rhov[n], E[n], fy_rho1, fy_rhou1, fy_rhov1, fy_E1);
+    fluxY(rho[s], rhou[s], rhov[s], E[s], fy_rho2, fy_rhou2, fy_rhov2, fy_E2);
+
+    rho_c = 0.25 * (rho[e] + rho[w] + rho[n] + rho[s]) - dtdx * (fx_rho1 - fx_rho2) - dtdy * (fy_rho1 - fy_rho2);
+    rhou_c = 0.25 * (rhou[e] + rhou[w] + rhou[n] + rhou[s]) - dtdx * (fx_rhou1 - fx_rhou2) - dtdy * (fy_rhou1 - fy_rhou2);
+    rhov_c = 0.25 * (rhov[e] + rhov[w] + rhov[n] + rhov[s]) - dtdx * (fx_rhov1 - fx_rhov2) - dtdy * (fy_rhov1 - fy_rhov2);
+    E_c = 0.25 * (E[e] + E[w] + E[n] + E[s]) - dtdx * (fx_E1 - fx_E2) - dtdy * (fy_E1 - fy_E2);
+}
+
 int main() {
     // Grid and domain parameters
     const int Nx = 200;         // Number of cells in x (excluding ghost cells)
@@ -53,9 +81,15 @@ int main() {
 
     // Create flat arrays (with ghost cells)
     const int total_size = (Nx + 2) * (Ny + 2);
-    vector<double> rho(total_size), rhou(total_size), rhov(total_size), E(total_size);
-    vector<double> rho_new(total_size), rhou_new(total_size), rhov_new(total_size), E_new(total_size);
-    vector<bool> solid(total_size, false);
+    // The kernels work on raw pointers so the current and next buffers can be swapped between
+    // steps; the mask is stored as char because vector<bool> cannot be mapped to the device
+    vector<double> storage(8 * total_size);
+    vector<char> solid_mask(total_size, 0);
+    double *rho = &storage[0*total_size], *rhou = &storage[1*total_size];
+    double *rhov = &storage[2*total_size], *E = &storage[3*total_size];
+    double *rho_new = &storage[4*total_size], *rhou_new = &storage[5*total_size];
+    double *rhov_new = &storage[6*total_size], *E_new = &storage[7*total_size];
+    char* solid = solid_mask.data();
 
     // Obstacle (cylinder) parameters
     const double cx = 0.5;      // Cylinder center x
@@ -70,19 +104,19 @@ int main() {
     const double E0 = p0/(gamma_val - 1.0) + 0.5*rho0*(u0*u0 + v0*v0);
 
     // Initialize grid and obstacle mask
-    #pragma omp target teams distribute parallel for collapse(2) map(to:cx,cy,radius,rho0,u0,v0,p0,E0) map(tofrom:rho[:total_size],rhou[:total_size],rhov[:total_size],E[:total_size],solid[:total_size])
+    #pragma omp target teams distribute parallel for collapse(2) map(to:cx,cy,radius,rho0,u0,v0,p0,E0) map(from:rho[:total_size],rhou[:total_size],rhov[:total_size],E[:total_size],solid[:total_size])
     for (int i = 0; i < Nx+2; i++) {
         for (int j = 0; j < Ny+2; j++) {
             double x = (i - 0.5) * dx;
             double y = (j - 0.5) * dy;
             if ((x - cx)*(x - cx) + (y - cy)*(y - cy) <= radius * radius) {
-                solid[i*(Ny+2)+j] = true;
+                solid[i*(Ny+2)+j] = 1;
                 rho[i*(Ny+2)+j] = rho0;
                 rhou[i*(Ny+2)+j] = 0.0;
                 rhov[i*(Ny+2)+j] = 0.0;
                 E[i*(Ny+2)+j] = p0/(gamma_val - 1.0);
             } else {
-                solid[i*(Ny+2)+j] = false;
+                solid[i*(Ny+2)+j] = 0;
                 rho[i*(Ny+2)+j] = rho0;
                 rhou[i*(Ny+2)+j] = rho0 * u0;
                 rhov[i*(Ny+2)+j] = rho0 * v0;
@@ -98,109 +132,96 @@ int main() {
     // Time stepping parameters
     const int nSteps = 2000;
 
-    // Main time-stepping loop
-    #pragma omp target data map(tofrom:rho[:total_size],rhou[:total_size],rhov[:total_size],E[:total_size]) \
+    const double dtdx = dt / (2 * dx);
+    const double dtdy = dt / (2 * dy);
+
+    // Main time-stepping loop. Each step is a single kernel over all cells, ghosts included:
+    // interior cells get the Lax-Friedrichs update and ghost cells get the boundary value of the
+    // new state (the update of the interior cell they mirror is recomputed, so no second pass
+    // has to wait for it). The buffers are then swapped instead of copied. The kinetic energy
+    // is only reduced, and copied back, on the steps that print it. The fields stay on the
+    // device: the initial state goes in, the new-state buffers are device scratch, and only the
+    // final state comes back.
+    #pragma omp target data map(to:rho[:total_size],rhou[:total_size],rhov[:total_size],E[:total_size],solid[:total_size]) \
                           map(alloc:rho_new[:total_size],rhou_new[:total_size],rhov_new[:total_size],E_new[:total_size])
     {
-        for (int n = 0; n < nSteps; n++) {
-            // Apply boundary conditions
-            #pragma omp target teams distribute parallel for
-            for (int j = 0; j < Ny+2; j++) {
-                // Left boundary (inflow)
-                rho[0*(Ny+2)+j] = rho0;
-                rhou[0*(Ny+2)+j] = rho0*u0;
-                rhov[0*(Ny+2)+j] = rho0*v0;
-                E[0*(Ny+2)+j] = E0;
-                // Right boundary (outflow)
-                rho[(Nx+1)*(Ny+2)+j] = rho[Nx*(Ny+2)+j];
-                rhou[(Nx+1)*(Ny+2)+j] = rhou[Nx*(Ny+2)+j];
-                rhov[(Nx+1)*(Ny+2)+j] = rhov[Nx*(Ny+2)+j];
-                E[(Nx+1)*(Ny+2)+j] = E[Nx*(Ny+2)+j];
-            }
+        // Boundary conditions of the initial state
+        #pragma omp target teams distribute parallel for
+        for (int j = 0; j < Ny+2; j++) {
+            // Left boundary (inflow)
+            rho[0*(Ny+2)+j] = rho0;
+            rhou[0*(Ny+2)+j] = rho0*u0;
+            rhov[0*(Ny+2)+j] = rho0*v0;
+            E[0*(Ny+2)+j] = E0;
+            // Right boundary (outflow)
+            rho[(Nx+1)*(Ny+2)+j] = rho[Nx*(Ny+2)+j];
+            rhou[(Nx+1)*(Ny+2)+j] = rhou[Nx*(Ny+2)+j];
+            rhov[(Nx+1)*(Ny+2)+j] = rhov[Nx*(Ny+2)+j];
+            E[(Nx+1)*(Ny+2)+j] = E[Nx*(Ny+2)+j];
+        }
 
-            #pragma omp target teams distribute parallel for
-            for (int i = 0; i < Nx+2; i++) {
-                // Bottom boundary (reflective)
-                rho[i*(Ny+2)+0] = rho[i*(Ny+2)+1];
-                rhou[i*(Ny+2)+0] = rhou[i*(Ny+2)+1];
-                rhov[i*(Ny+2)+0] = -rhov[i*(Ny+2)+1];
-                E[i*(Ny+2)+0] = E[i*(Ny+2)+1];
-                // Top boundary (reflective)
-                rho[i*(Ny+2)+(Ny+1)] = rho[i*(Ny+2)+Ny];
-                rhou[i*(Ny+2)+(Ny+1)] = rhou[i*(Ny+2)+Ny];
-                rhov[i*(Ny+2)+(Ny+1)] = -rhov[i*(Ny+2)+Ny];
-                E[i*(Ny+2)+(Ny+1)] = E[i*(Ny+2)+Ny];
-            }
+        #pragma omp target teams distribute parallel for
+        for (int i = 0; i < Nx+2; i++) {
+            // Bottom boundary (reflective)
+            rho[i*(Ny+2)+0] = rho[i*(Ny+2)+1];
+            rhou[i*(Ny+2)+0] = rhou[i*(Ny+2)+1];
+            rhov[i*(Ny+2)+0] = -rhov[i*(Ny+2)+1];
+            E[i*(Ny+2)+0] = E[i*(Ny+2)+1];
+            // Top boundary (reflective)
+            rho[i*(Ny+2)+(Ny+1)] = rho[i*(Ny+2)+Ny];
+            rhou[i*(Ny+2)+(Ny+1)] = rhou[i*(Ny+2)+Ny];
+            rhov[i*(Ny+2)+(Ny+1)] = -rhov[i*(Ny+2)+Ny];
+            E[i*(Ny+2)+(Ny+1)] = E[i*(Ny+2)+Ny];
+        }
 
-            // Update interior cells using a Lax-Friedrichs scheme
+        for (int n = 0; n < nSteps; n++) {
             #pragma omp target teams distribute parallel for collapse(2)
-            for (int i = 1; i <= Nx; i++) {
-                for (int j = 1; j <= Ny; j++) {
-                    if (solid[i*(Ny+2)+j]) {
-                        rho_new[i*(Ny+2)+j] = rho[i*(Ny+2)+j];
-                        rhou_new[i*(Ny+2)+j] = rhou[i*(Ny+2)+j];
-                        rhov_new[i*(Ny+2)+j] = rhov[i*(Ny+2)+j];
-                        E_new[i*(Ny+2)+j] = E[i*(Ny+2)+j];
+            for (int i = 0; i < Nx+2; i++) {
+                for (int j = 0; j < Ny+2; j++) {
+                    const int c = i*(Ny+2)+j;
+                    double rho_c, rhou_c, rhov_c, E_c;
+                    if (i == 0) {
+                        // Left boundary (inflow); the corners are reflected from the inflow state
+                        rho_c = rho0;
+                        rhou_c = rho0*u0;
+                        rhov_c = (j == 0 || j == Ny+1) ? -(rho0*v0) : rho0*v0;
+                        E_c = E0;
                     } else {
-                        // Lax averaging and flux computation
-                        double fx_rho1, fx_rhou1, fx_rhov1, fx_E1;
-                        double fx_rho2, fx_rhou2, fx_rhov2, fx_E2;
-                        double fy_rho1, fy_rhou1, fy_rhov1, fy_E1;
-                        double fy_rho2, fy_rhou2, fy_rhov2, fy_E2;
-
-                        fluxX(rho[(i+1)*(Ny+2)+j], rhou[(i+1)*(Ny+2)+j], rhov[(i+1)*(Ny+2)+j], E[(i+1)*(Ny+2)+j],
-                              fx_rho1, fx_rhou1, fx_rhov1, fx_E1);
-                        fluxX(rho[(i-1)*(Ny+2)+j], rhou[(i-1)*(Ny+2)+j], rhov[(i-1)*(Ny+2)+j], E[(i-1)*(Ny+2)+j],
-                              fx_rho2, fx_rhou2, fx_rhov2, fx_E2);
-                        fluxY(rho[i*(Ny+2)+(j+1)], rhou[i*(Ny+2)+(j+1)], rhov[i*(Ny+2)+(j+1)], E[i*(Ny+2)+(j+1)],
-                              fy_rho1, fy_rhou1, fy_rhov1, fy_E1);
-                        fluxY(rho[i*(Ny+2)+(j-1)], rhou[i*(Ny+2)+(j-1)], rhov[i*(Ny+2)+(j-1)], E[i*(Ny+2)+(j-1)],
-                              fy_rho2, fy_rhou2, fy_rhov2, fy_E2);
-
-                        double dtdx = dt / (2 * dx);
-                        double dtdy = dt / (2 * dy);
-
-                        rho_new[i*(Ny+2)+j] = 0.25 * (rho[(i+1)*(Ny+2)+j] + rho[(i-1)*(Ny+2)+j] + 
-                                                      rho[i*(Ny+2)+(j+1)] + rho[i*(Ny+2)+(j-1)]) -
-                                              dtdx * (fx_rho1 - fx_rho2) - dtdy * (fy_rho1 - fy_rho2);
-                        rhou_new[i*(Ny+2)+j] = 0.25 * (rhou[(i+1)*(Ny+2)+j] + rhou[(i-1)*(Ny+2)+j] + 
-                                                       rhou[i*(Ny+2)+(j+1)] + rhou[i*(Ny+2)+(j-1)]) -
-                                               dtdx * (fx_rhou1 - fx_rhou2) - dtdy * (fy_rhou1 - fy_rhou2);
-                        rhov_new[i*(Ny+2)+j] = 0.25 * (rhov[(i+1)*(Ny+2)+j] + rhov[(i-1)*(Ny+2)+j] + 
-                                                       rhov[i*(Ny+2)+(j+1)] + rhov[i*(Ny+2)+(j-1)]) -
-                                               dtdx * (fx_rhov1 - fx_rhov2) - dtdy * (fy_rhov1 - fy_rhov2);
-                        E_new[i*(Ny+2)+j] = 0.25 * (E[(i+1)*(Ny+2)+j] + E[(i-1)*(Ny+2)+j] + 
-                                                    E[i*(Ny+2)+(j+1)] + E[i*(Ny+2)+(j-1)]) -
-                                            dtdx * (fx_E1 - fx_E2) - dtdy * (fy_E1 - fy_E2);
+                        // Ghost cells mirror an interior cell: the right boundary copies column Nx,
+                        // the bottom and top reflect rows 1 and Ny
+                        const int si = i == Nx+1 ? Nx : i;
+                        const int sj = j == 0 ? 1 : (j == Ny+1 ? Ny : j);
+                        lax_friedrichs_cell(rho, rhou, rhov, E, solid, si*(Ny+2)+sj, Ny+2, dtdx, dtdy,
+                                            rho_c, rhou_c, rhov_c, E_c);
+                        if (sj != j) rhov_c = -rhov_c;
                     }
+                    rho_new[c] = rho_c;
+                    rhou_new[c] = rhou_c;
+                    rhov_new[c] = rhov_c;
+                    E_new[c] = E_c;
                 }
             }
+            swap(rho, rho_new);
+            swap(rhou, rhou_new);
+            swap(rhov, rhov_new);
+            swap(E, E_new);
 
-            // Copy updated values back
-            #pragma omp target teams distribute parallel for collapse(2)
-            for (int i = 1; i <= Nx; i++) {
-                for (int j = 1; j <= Ny; j++) {
-                    rho[i*(Ny+2)+j] = rho_new[i*(Ny+2)+j];
-                    rhou[i*(Ny+2)+j] = rhou_new[i*(Ny+2)+j];
-                    rhov[i*(Ny+2)+j] = rhov_new[i*(Ny+2)+j];
-                    E[i*(Ny+2)+j] = E_new[i*(Ny+2)+j];
-                }
-            }
-
-            // Calculate total kinetic energy (on CPU for simplicity)
             if (n % 50 == 0) {
+                // Kinetic energy of the interior of the state just computed
                 double total_kinetic = 0.0;
                 #pragma omp target teams distribute parallel for collapse(2) map(tofrom:total_kinetic) reduction(+:total_kinetic)
                 for (int i = 1; i <= Nx; i++) {
                     for (int j = 1; j <= Ny; j++) {
-                        double u = rhou[i*(Ny+2)+j] / rho[i*(Ny+2)+j];
-                        double v = rhov[i*(Ny+2)+j] / rho[i*(Ny+2)+j];
-                        total_kinetic += 0.5 * rho[i*(Ny+2)+j] * (u * u + v * v);
+                        const int c = i*(Ny+2)+j;
+                        double u = rhou[c] / rho[c];
+                        double v = rhov[c] / rho[c];
+                        total_kinetic += 0.5 * rho[c] * (u * u + v * v);
                     }
                 }
                 cout << "Step " << n << " completed, total kinetic energy: " << total_kinetic << endl;
             }
         }
+        #pragma omp target update from(rho[:total_size],rhou[:total_size],rhov[:total_size],E[:total_size])
     }
 
     auto t2 = chrono::high_resolution_clock::now();
@@ -2,78 +2,3625 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <omp.h>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <array>
+#include <type_traits>
+#include <atomic>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 // Function prototypes
 void matrix_vector_multiply_csr(const double* values, const int* col_indices, const int* row_start, const double* x, double* result, int n);
 
-void conjugate_gradient_csr(const double* values, const int* col_indices, const int* row_start, const double* b, double* x, int n, int max_iterations, double tolerance) {
+// Preconditioner interface: z = M^-1 * r
+struct Preconditioner {
+    virtual ~Preconditioner() {}
+    virtual void apply(const double* r, double* z, int n) = 0;
+};
+
+// Matrix interface for the solvers: y = A * x, whatever the storage format
+struct LinearOperator {
+    virtual ~LinearOperator() {}
+    virtual void apply(const double* x, double* y, int n) = 0;
+};
+
+struct CSROperator : LinearOperator {
+    const double* values;
+    const int* col_indices;
+    const int* row_start;
+
+    CSROperator(const double* values, const int* col_indices, const int* row_start)
+        : values(values), col_indices(col_indices), row_start(row_start) {}
+
+    void apply(const double* x, double* y, int n) override {
+        matrix_vector_multiply_csr(values, col_indices, row_start, x, y, n);
+    }
+};
+
+// Scratch vectors for CG that can be kept alive across solves instead of reallocated each call
+struct CGWorkspace {
+    std::vector<double> r, p, Ap, Ax, z;
+
+    void resize(int n) {
+        r.resize(n);
+        p.resize(n);
+        Ap.resize(n);
+        Ax.resize(n);
+        z.resize(n);
+    }
+};
+
+// CG step lengths alpha_k and direction updates beta_k = rsnew/rsold. They define the Lanczos
+// tridiagonal matrix of (M^-1)A, see lanczos_spectral_estimate.
+struct CGHistory {
+    std::vector<double> alpha, beta;
+};
+
+// Per-iteration solver telemetry. The solver pushes fixed-size records into a preallocated
+// single-producer/single-consumer ring and a background thread drains it to a binary log, so
+// the iteration itself never formats, locks or flushes. Given a shared-memory name the ring is
+// a POSIX shared-memory object that `./cg monitor` maps to follow a running solve; without a
+// log the ring keeps the most recent records instead.
+struct TelemetryRecord {
+    int64_t iteration;
+    double residual, alpha, beta;
+    double spmv_seconds, precond_seconds, vector_seconds;
+};
+
+#define TELEMETRY_SHM_NAME "/cg_solver_telemetry"
+const uint32_t TELEMETRY_MAGIC = 0x4c544743;   // "CGTL"
+
+struct TelemetryRingHeader {
+    uint32_t magic;
+    uint32_t capacity;                 // power of two
+    std::atomic<uint64_t> head;        // next slot the producer writes
+    std::atomic<uint64_t> tail;        // next slot the consumer reads
+    std::atomic<uint64_t> dropped;     // records lost because the consumer fell behind
+    std::atomic<int> finished;
+};
+
+// Binary log: this header followed by the raw records
+struct TelemetryLogHeader {
+    uint32_t magic;
+    uint32_t record_size;
+};
+
+size_t telemetry_ring_size(uint32_t capacity) {
+    return sizeof(TelemetryRingHeader) + (size_t)capacity * sizeof(TelemetryRecord);
+}
+
+class SolverTelemetry {
+public:
+    SolverTelemetry(uint32_t min_capacity = 4096, const char* log_path = nullptr, const char* shm_name = nullptr) {
+        capacity = 1;
+        while (capacity < min_capacity) capacity <<= 1;
+        void* memory = MAP_FAILED;
+        if (shm_name) {
+            int fd = shm_open(shm_name, O_CREAT | O_RDWR, 0600);
+            if (fd >= 0 && ftruncate(fd, telemetry_ring_size(capacity)) == 0) {
+                memory = mmap(nullptr, telemetry_ring_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                this->shm_name = shm_name;
+            } else {
+                perror("shm_open");
+            }
+            if (fd >= 0) close(fd);
+        }
+        if (memory == MAP_FAILED) {
+            memory = mmap(nullptr, telemetry_ring_size(capacity), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        header = new (memory) TelemetryRingHeader();
+        header->capacity = capacity;
+        records = (TelemetryRecord*)((char*)memory + sizeof(TelemetryRingHeader));
+        header->magic = TELEMETRY_MAGIC;
+
+        if (log_path) {
+            log.open(log_path, std::ios::binary);
+            TelemetryLogHeader file_header = {TELEMETRY_MAGIC, sizeof(TelemetryRecord)};
+            log.write((const char*)&file_header, sizeof(file_header));
+            consumer = std::thread([this] { drain(); });
+        }
+    }
+
+    ~SolverTelemetry() {
+        finish();
+        munmap(header, telemetry_ring_size(capacity));
+        if (!shm_name.empty()) shm_unlink(shm_name.c_str());
+    }
+
+    // Called by the solver thread only. Never blocks: a full ring drops the record when a
+    // consumer is draining it and overwrites the oldest one otherwise.
+    void record(const TelemetryRecord& r) {
+        const uint64_t h = header->head.load(std::memory_order_relaxed);
+        const uint64_t t = header->tail.load(std::memory_order_acquire);
+        if (h - t == capacity) {
+            if (consumer.joinable()) {
+                header->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            header->tail.store(t + 1, std::memory_order_release);
+        }
+        records[h & (capacity - 1)] = r;
+        header->head.store(h + 1, std::memory_order_release);
+    }
+
+    // Marks the solve finished and waits until the log holds every record
+    void finish() {
+        header->finished.store(1, std::memory_order_release);
+        stop.store(true, std::memory_order_release);
+        if (consumer.joinable()) consumer.join();
+        if (log.is_open()) log.close();
+    }
+
+    uint64_t recorded() const { return header->head.load(std::memory_order_acquire); }
+    uint64_t dropped() const { return header->dropped.load(std::memory_order_relaxed); }
+
+private:
+    TelemetryRingHeader* header = nullptr;
+    TelemetryRecord* records = nullptr;
+    uint32_t capacity;
+    std::string shm_name;
+    std::ofstream log;
+    std::thread consumer;
+    std::atomic<bool> stop{false};
+
+    void drain() {
+        while (true) {
+            // Read the stop flag before head so the last batch is never missed
+            const bool stopping = stop.load(std::memory_order_acquire);
+            uint64_t t = header->tail.load(std::memory_order_relaxed);
+            const uint64_t h = header->head.load(std::memory_order_acquire);
+            if (t == h) {
+                if (stopping) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            while (t != h) {
+                const uint64_t slot = t & (capacity - 1);
+                const uint64_t count = std::min<uint64_t>(h - t, capacity - slot);
+                log.write((const char*)&records[slot], count * sizeof(TelemetryRecord));
+                t += count;
+            }
+            header->tail.store(t, std::memory_order_release);
+        }
+        log.flush();
+    }
+};
+
+bool read_telemetry_log(const char* path, std::vector<TelemetryRecord>& out) {
+    std::ifstream in(path, std::ios::binary);
+    TelemetryLogHeader file_header;
+    if (!in.read((char*)&file_header, sizeof(file_header)) || file_header.magic != TELEMETRY_MAGIC || file_header.record_size != sizeof(TelemetryRecord)) {
+        return false;
+    }
+    TelemetryRecord r;
+    out.clear();
+    while (in.read((char*)&r, sizeof(r))) out.push_back(r);
+    return true;
+}
+
+// Follows a solve that publishes its telemetry under TELEMETRY_SHM_NAME, printing the latest
+// record twice a second until the solver marks the ring finished
+int run_telemetry_monitor() {
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; ++attempt) {
+        fd = shm_open(TELEMETRY_SHM_NAME, O_RDONLY, 0600);
+        if (fd < 0) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (fd < 0) {
+        perror("shm_open (is a solve with telemetry running?)");
+        return 1;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    char* memory = (char*)mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    const TelemetryRingHeader* header = (const TelemetryRingHeader*)memory;
+    const TelemetryRecord* records = (const TelemetryRecord*)(memory + sizeof(TelemetryRingHeader));
+    if (header->magic != TELEMETRY_MAGIC) {
+        std::cerr << "Not a telemetry ring" << std::endl;
+        return 1;
+    }
+    while (true) {
+        const bool finished = header->finished.load(std::memory_order_acquire);
+        const uint64_t head = header->head.load(std::memory_order_acquire);
+        if (head > 0) {
+            const TelemetryRecord r = records[(head - 1) & (header->capacity - 1)];
+            std::cout << "iteration " << r.iteration << " residual " << r.residual << " alpha " << r.alpha << " beta " << r.beta
+                      << " spmv " << r.spmv_seconds * 1e3 << "ms vector " << r.vector_seconds * 1e3 << "ms" << std::endl;
+        }
+        if (finished) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    munmap(memory, info.st_size);
+    return 0;
+}
+
+// FNV-1a hash of `bytes` bytes, continuing from `hash`
+const uint64_t FNV_OFFSET_BASIS = 1469598103934665603ull;
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t bytes) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < bytes; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Periodic checkpoint of the CG state needed to continue a solve: x, r, p, rsold and the
+// number of completed iterations. Saving copies the state into a staging buffer and a
+// background thread writes it to <path>.tmp and renames it over <path>, so the solver only
+// pays for the copy and a crash never leaves a torn file. A save that comes due while the
+// previous one is still being written is skipped. The header carries a fingerprint of the
+// system (see system_fingerprint), so a file left by a different solve of the same size is
+// not resumed; the file is deleted once the solve converges.
+struct CheckpointHeader {
+    uint32_t magic;
+    int32_t n;
+    int32_t iteration;
+    double rsold;
+    uint64_t fingerprint;
+};
+
+const uint32_t CHECKPOINT_MAGIC = 0x4b434743;   // "CGCK"
+
+// Fingerprint of the system A x = b for checkpoint matching: the bits of b and of A applied to
+// a fixed probe vector, which works for any LinearOperator. Costs one application of A;
+// `probe` and `result` are n-element scratch vectors.
+uint64_t system_fingerprint(LinearOperator& A, const double* b, int n, double* probe, double* result) {
+    for (int i = 0; i < n; ++i) probe[i] = 1.0 + 1.0 / (1 + i % 97);
+    A.apply(probe, result, n);
+    uint64_t hash = fnv1a(FNV_OFFSET_BASIS, &n, sizeof(n));
+    hash = fnv1a(hash, b, n * sizeof(double));
+    return fnv1a(hash, result, n * sizeof(double));
+}
+
+class CGCheckpoint {
+public:
+    // Saves every `every_iterations` iterations and/or every `every_seconds` seconds
+    // (either may be 0 to disable it)
+    CGCheckpoint(const std::string& path, int every_iterations, double every_seconds = 0.0)
+        : path(path), every_iterations(every_iterations), every_seconds(every_seconds), last_save(std::chrono::steady_clock::now()) {}
+
+    ~CGCheckpoint() { wait(); }
+
+    // Restores a saved state of the system with the given size and fingerprint; false if there
+    // is none. Later saves are tagged with the fingerprint.
+    bool load(int n, uint64_t fingerprint, double* x, double* r, double* p, double& rsold, int& iteration) {
+        system = fingerprint;
+        std::ifstream in(path, std::ios::binary);
+        CheckpointHeader header;
+        if (!in.read((char*)&header, sizeof(header)) || header.magic != CHECKPOINT_MAGIC || header.n != n ||
+            header.fingerprint != fingerprint) {
+            return false;
+        }
+        if (!in.read((char*)x, n * sizeof(double)) || !in.read((char*)r, n * sizeof(double)) || !in.read((char*)p, n * sizeof(double))) {
+            return false;
+        }
+        rsold = header.rsold;
+        iteration = header.iteration;
+        return true;
+    }
+
+    // Called by the solver after every completed iteration
+    void maybe_save(int iteration, const double* x, const double* r, const double* p, double rsold, int n) {
+        const auto now = std::chrono::steady_clock::now();
+        const bool due = (every_iterations > 0 && iteration % every_iterations == 0) ||
+                         (every_seconds > 0.0 && std::chrono::duration<double>(now - last_save).count() >= every_seconds);
+        if (!due || busy.load(std::memory_order_acquire)) return;
+        if (writer.joinable()) writer.join();
+        last_save = now;
+        staging.resize(3 * (size_t)n);
+        std::copy(x, x + n, staging.begin());
+        std::copy(r, r + n, staging.begin() + n);
+        std::copy(p, p + n, staging.begin() + 2 * (size_t)n);
+        CheckpointHeader header = {CHECKPOINT_MAGIC, n, iteration, rsold, system};
+        busy.store(true, std::memory_order_release);
+        writer = std::thread([this, header] {
+            // Only a completely written file replaces the previous checkpoint; a failed write
+            // (disk full, say) leaves the old one in place
+            const std::string tmp = path + ".tmp";
+            std::ofstream out(tmp, std::ios::binary);
+            out.write((const char*)&header, sizeof(header));
+            out.write((const char*)staging.data(), staging.size() * sizeof(double));
+            out.close();
+            if (out.good() && std::rename(tmp.c_str(), path.c_str()) == 0) {
+                saved++;
+            } else {
+                std::cerr << "CGCheckpoint: could not write " << path << " at iteration " << header.iteration << std::endl;
+                std::remove(tmp.c_str());
+            }
+            busy.store(false, std::memory_order_release);
+        });
+    }
+
+    // Blocks until the last checkpoint is on disk
+    void wait() {
+        if (writer.joinable()) writer.join();
+    }
+
+    // The solve converged: the saved state is no longer needed
+    void discard() {
+        wait();
+        std::remove(path.c_str());
+    }
+
+    // Checkpoints successfully written so far
+    int saves() const { return saved; }
+
+private:
+    std::string path;
+    int every_iterations;
+    double every_seconds;
+    std::chrono::steady_clock::time_point last_save;
+    uint64_t system = 0;
+    std::vector<double> staging;
+    std::thread writer;
+    std::atomic<bool> busy{false};
+    std::atomic<int> saved{0};
+};
+
+// ------------------------------------------------------------
+// Expression templates for the Krylov vector updates. Vec is a view of n doubles owned
+// elsewhere; arithmetic on views builds expression objects instead of temporaries and an
+// assignment evaluates the whole right-hand side in one parallel loop. fused() runs several
+// updates and dot products in a single pass, applying the statements in order to each entry:
+//     double rr = fused(update(x) += alpha * p, update(r) -= alpha * Ap, dot(r, r));
+// ------------------------------------------------------------
+
+// Shorter loops stay serial, forking the threads would cost more than the pass itself
+const int FUSED_PARALLEL_THRESHOLD = 1 << 15;
+
+template <class E>
+struct VecExpr {
+    const E& self() const { return static_cast<const E&>(*this); }
+};
+
+template <class... S>
+auto fused(const S&... statements);
+
+struct ConstVec : VecExpr<ConstVec> {
+    const double* data;
+    int n;
+    ConstVec(const double* data, int n) : data(data), n(n) {}
+    double operator[](int i) const { return data[i]; }
+    int size() const { return n; }
+};
+
+struct Vec : VecExpr<Vec> {
+    double* data;
+    int n;
+    Vec(double* data, int n) : data(data), n(n) {}
+    Vec(const Vec&) = default;
+    double operator[](int i) const { return data[i]; }
+    int size() const { return n; }
+
+    // Assignments copy values, they never rebind the view
+    Vec& operator=(const Vec& e);
+    template <class E> Vec& operator=(const VecExpr<E>& e);
+    template <class E> Vec& operator+=(const VecExpr<E>& e);
+    template <class E> Vec& operator-=(const VecExpr<E>& e);
+};
+
+// Subexpressions are held by value: views and scalars are cheap to copy and nothing dangles
+template <class E>
+struct Scaled : VecExpr<Scaled<E>> {
+    double a;
+    E e;
+    Scaled(double a, const E& e) : a(a), e(e) {}
+    double operator[](int i) const { return a * e[i]; }
+    int size() const { return e.size(); }
+};
+
+template <class L, class R, int SIGN>
+struct Sum : VecExpr<Sum<L, R, SIGN>> {
+    L l;
+    R r;
+    Sum(const L& l, const R& r) : l(l), r(r) {}
+    double operator[](int i) const { return SIGN > 0 ? l[i] + r[i] : l[i] - r[i]; }
+    int size() const { return l.size(); }
+};
+
+// Entrywise product, e.g. a diagonal scaling
+template <class L, class R>
+struct Product : VecExpr<Product<L, R>> {
+    L l;
+    R r;
+    Product(const L& l, const R& r) : l(l), r(r) {}
+    double operator[](int i) const { return l[i] * r[i]; }
+    int size() const { return l.size(); }
+};
+
+template <class E> Scaled<E> operator*(double a, const VecExpr<E>& e) { return Scaled<E>(a, e.self()); }
+template <class L, class R> Sum<L, R, 1> operator+(const VecExpr<L>& l, const VecExpr<R>& r) { return Sum<L, R, 1>(l.self(), r.self()); }
+template <class L, class R> Sum<L, R, -1> operator-(const VecExpr<L>& l, const VecExpr<R>& r) { return Sum<L, R, -1>(l.self(), r.self()); }
+template <class L, class R> Product<L, R> operator*(const VecExpr<L>& l, const VecExpr<R>& r) { return Product<L, R>(l.self(), r.self()); }
+
+// Statements for fused(): target = e, target += e or target -= e (mode 0, 1, -1)
+template <class E>
+struct Assign {
+    double* target;
+    E e;
+    int mode;
+    int size() const { return e.size(); }
+    void step(int i, double*&) const {
+        const double v = e[i];
+        target[i] = mode == 0 ? v : mode > 0 ? target[i] + v : target[i] - v;
+    }
+};
+
+struct Update {
+    double* target;
+    template <class E> Assign<E> operator=(const VecExpr<E>& e) const { return {target, e.self(), 0}; }
+    template <class E> Assign<E> operator+=(const VecExpr<E>& e) const { return {target, e.self(), 1}; }
+    template <class E> Assign<E> operator-=(const VecExpr<E>& e) const { return {target, e.self(), -1}; }
+};
+
+// Deferred update of v, to be run by fused() together with other statements
+inline Update update(Vec v) { return {v.data}; }
+
+// Inner product; evaluated on its own when converted to double, or as one of the reductions
+// of a fused() pass
+template <class L, class R>
+struct Dot {
+    L l;
+    R r;
+    int size() const { return l.size(); }
+    void step(int i, double*& slot) const { *slot++ += l[i] * r[i]; }
+    operator double() const { return fused(*this); }
+};
+
+template <class L, class R> Dot<L, R> dot(const VecExpr<L>& l, const VecExpr<R>& r) { return {l.self(), r.self()}; }
+
+template <class S> struct is_reduction : std::false_type {};
+template <class L, class R> struct is_reduction<Dot<L, R>> : std::true_type {};
+
+template <class S, class... Rest>
+int statement_size(const S& s, const Rest&...) { return s.size(); }
+
+// One pass over all statements. Returns nothing, the dot product, or an array of the dot
+// products in statement order.
+template <class... S>
+auto fused(const S&... statements) {
+    constexpr int K = (0 + ... + (is_reduction<S>::value ? 1 : 0));
+    const int n = statement_size(statements...);
+    if constexpr (K == 0) {
+        #pragma omp parallel for schedule(static) if(n >= FUSED_PARALLEL_THRESHOLD)
+        for (int i = 0; i < n; ++i) {
+            double* slot = nullptr;
+            (statements.step(i, slot), ...);
+        }
+    } else {
+        double sums[K] = {};
+        #pragma omp parallel for schedule(static) reduction(+:sums) if(n >= FUSED_PARALLEL_THRESHOLD)
+        for (int i = 0; i < n; ++i) {
+            double* slot = sums;
+            (statements.step(i, slot), ...);
+        }
+        if constexpr (K == 1) {
+            return sums[0];
+        } else {
+            std::array<double, K> result;
+            std::copy(sums, sums + K, result.begin());
+            return result;
+        }
+    }
+}
+
+inline Vec& Vec::operator=(const Vec& e) { fused(Assign<Vec>{data, e, 0}); return *this; }
+template <class E> Vec& Vec::operator=(const VecExpr<E>& e) { fused(Assign<E>{data, e.self(), 0}); return *this; }
+template <class E> Vec& Vec::operator+=(const VecExpr<E>& e) { fused(Assign<E>{data, e.self(), 1}); return *this; }
+template <class E> Vec& Vec::operator-=(const VecExpr<E>& e) { fused(Assign<E>{data, e.self(), -1}); return *this; }
+
+// Returns the number of iterations performed. With precond == nullptr this is plain CG. With
+// telemetry every iteration is recorded there and the periodic residual printout is skipped.
+// With a checkpoint the solve resumes from its saved state if there is one (the iteration
+// count includes the iterations done before the restart) and saves as configured. With
+// verbose == false nothing is printed.
+int conjugate_gradient(LinearOperator& A, const double* b, double* x, int n, int max_iterations, double tolerance, Preconditioner* precond = nullptr,
+                       CGWorkspace* workspace = nullptr, CGHistory* history = nullptr, SolverTelemetry* telemetry = nullptr,
+                       CGCheckpoint* checkpoint = nullptr, bool verbose = true) {
+    if (workspace) workspace->resize(n);
+    double* r = workspace ? workspace->r.data() : new double[n];
+    double* p = workspace ? workspace->p.data() : new double[n];
+    double* Ap = workspace ? workspace->Ap.data() : new double[n];
+    double* Ax = workspace ? workspace->Ax.data() : new double[n];
+    // Without a preconditioner z aliases r, so rsold/rsnew are the usual r.r
+    double* z = !precond ? r : workspace ? workspace->z.data() : new double[n];
+
+    Vec xv(x, n), rv(r, n), pv(p, n), Apv(Ap, n), zv(z, n);
+
+    double rsold = 0.0;
+    int first_iteration = 0;
+    if (!checkpoint || !checkpoint->load(n, system_fingerprint(A, b, n, p, Ap), x, r, p, rsold, first_iteration)) {
+        // Initial step: compute r = b - A*x
+        A.apply(x, Ax, n);
+        rv = ConstVec(b, n) - Vec(Ax, n);
+        if (precond) precond->apply(r, z, n);
+        pv = zv;
+        rsold = dot(rv, zv);
+    }
+
+    // Phase timestamps, only taken when telemetry is attached
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point t_start, t_spmv, t_precond_start, t_precond_end;
+    auto seconds = [](Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double>(b - a).count(); };
+
+    int iterations = max_iterations;
+    bool converged = false;
+    for (int i = first_iteration; i < max_iterations; ++i) {
+        if (telemetry) t_start = Clock::now();
+        A.apply(p, Ap, n);
+        if (telemetry) t_spmv = Clock::now();
+        double alpha = rsold / dot(pv, Apv);
+        if (history) history->alpha.push_back(alpha);
+
+        // x and r updates and the new residual norm in one pass
+        double rr = fused(update(xv) += alpha * pv, update(rv) -= alpha * Apv, dot(rv, rv));
+
+        if (sqrt(rr) < tolerance) {
+            if (telemetry) {
+                Clock::time_point t_end = Clock::now();
+                telemetry->record({i, sqrt(rr), alpha, 0.0, seconds(t_start, t_spmv), 0.0, seconds(t_spmv, t_end)});
+            }
+	    if (verbose) std::cout << "Final residual " << sqrt(rr) << std::endl;
+            iterations = i + 1;
+            converged = true;
+            break;
+        } else if (i%100 == 0 && !telemetry && verbose) {
+	    std::cout << i << " residual " << sqrt(rr) << '\n';
+	}
+
+        double rsnew = rr;
+        if (precond) {
+            if (telemetry) t_precond_start = Clock::now();
+            precond->apply(r, z, n);
+            if (telemetry) t_precond_end = Clock::now();
+            rsnew = dot(rv, zv);
+        }
+
+        if (history) history->beta.push_back(rsnew / rsold);
+        pv = zv + (rsnew / rsold) * pv;
+
+        if (telemetry) {
+            Clock::time_point t_end = Clock::now();
+            const double precond_seconds = precond ? seconds(t_precond_start, t_precond_end) : 0.0;
+            telemetry->record({i, sqrt(rr), alpha, rsnew / rsold, seconds(t_start, t_spmv), precond_seconds,
+                               seconds(t_spmv, t_end) - precond_seconds});
+        }
+        rsold = rsnew;
+        if (checkpoint) checkpoint->maybe_save(i + 1, x, r, p, rsold, n);
+    }
+    if (checkpoint) {
+        if (converged) {
+            checkpoint->discard();
+        } else {
+            checkpoint->wait();
+        }
+    }
+
+    if (!workspace) {
+        delete[] r;
+        delete[] p;
+        delete[] Ap;
+        delete[] Ax;
+        if (precond) delete[] z;
+    }
+    return iterations;
+}
+
+int conjugate_gradient_csr(const double* values, const int* col_indices, const int* row_start, const double* b, double* x, int n, int max_iterations, double tolerance, Preconditioner* precond = nullptr,
+                           CGHistory* history = nullptr, bool verbose = true) {
+    CSROperator A(values, col_indices, row_start);
+    return conjugate_gradient(A, b, x, n, max_iterations, tolerance, precond, nullptr, history, nullptr, nullptr, verbose);
+}
+
+// BiCGStab for nonsymmetric A, right preconditioned (A M^-1 y = b, x = M^-1 y) so the
+// residual it monitors is the true one. Returns the number of iterations performed, or -1 on
+// a breakdown (rho, r0.v or omega vanishing before convergence); with verbose == false only
+// breakdowns are reported.
+int bicgstab(LinearOperator& A, const double* b, double* x, int n, int max_iterations, double tolerance, Preconditioner* precond = nullptr,
+             bool verbose = true) {
+    std::vector<double> r(n), r0(n), p(n, 0.0), v(n, 0.0), s(n), t(n);
+    std::vector<double> phat(precond ? n : 0), shat(precond ? n : 0);
+    Vec xv(x, n), rv(r.data(), n), r0v(r0.data(), n), pv(p.data(), n), vv(v.data(), n), sv(s.data(), n), tv(t.data(), n);
+    // Without a preconditioner phat and shat are p and s
+    Vec phatv(precond ? phat.data() : p.data(), n), shatv(precond ? shat.data() : s.data(), n);
+
+    A.apply(x, t.data(), n);
+    rv = ConstVec(b, n) - tv;
+    r0v = rv;
+    double rho = 1.0, alpha = 1.0, omega = 1.0;
+    double rho_new = dot(r0v, rv);
+    // r0 = r, so rho = r.r: a zero initial residual is already converged
+    if (rho_new == 0.0) return 0;
+
+    int iterations = max_iterations;
+    for (int i = 0; i < max_iterations; ++i) {
+        if (rho_new == 0.0) {
+            std::cerr << "BiCGStab breakdown at iteration " << i << ": rho = 0" << std::endl;
+            return -1;
+        }
+        const double beta = (rho_new / rho) * (alpha / omega);
+        rho = rho_new;
+        pv = rv + beta * (pv - omega * vv);
+        if (precond) precond->apply(p.data(), phatv.data, n);
+        A.apply(phatv.data, v.data(), n);
+        const double r0v_dot = dot(r0v, vv);
+        if (r0v_dot == 0.0) {
+            std::cerr << "BiCGStab breakdown at iteration " << i << ": r0.v = 0" << std::endl;
+            return -1;
+        }
+        alpha = rho / r0v_dot;
+
+        const double ss = fused(update(sv) = rv - alpha * vv, dot(sv, sv));
+        if (sqrt(ss) < tolerance) {
+            xv += alpha * phatv;
+            if (verbose) std::cout << "Final residual " << sqrt(ss) << std::endl;
+            iterations = i + 1;
+            break;
+        }
+        if (precond) precond->apply(s.data(), shatv.data, n);
+        A.apply(shatv.data, t.data(), n);
+        const std::array<double, 2> ts_tt = fused(dot(tv, sv), dot(tv, tv));
+        if (ts_tt[0] == 0.0 || ts_tt[1] == 0.0) {
+            std::cerr << "BiCGStab breakdown at iteration " << i << ": omega = 0" << std::endl;
+            return -1;
+        }
+        omega = ts_tt[0] / ts_tt[1];
+
+        // Solution and residual updates, the residual norm and the next rho in one pass
+        const std::array<double, 2> rr_rho = fused(update(xv) += alpha * phatv + omega * shatv, update(rv) = sv - omega * tv,
+                                                   dot(rv, rv), dot(r0v, rv));
+        rho_new = rr_rho[1];
+        if (sqrt(rr_rho[0]) < tolerance) {
+            if (verbose) std::cout << "Final residual " << sqrt(rr_rho[0]) << std::endl;
+            iterations = i + 1;
+            break;
+        } else if (i % 100 == 0 && verbose) {
+            std::cout << i << " residual " << sqrt(rr_rho[0]) << '\n';
+        }
+    }
+    return iterations;
+}
+
+// Classical Gram-Schmidt projection of w against the basis vectors V[0..k) in a single pass,
+// h[j] = V_j . w for all j at once. With `correction` the previous projection is subtracted
+// first in the same pass, w -= V correction, so one pass does one CGS sweep's update and the
+// next sweep's projection. With h == nullptr only the update is done and w.w is returned.
+double block_project(const double* V, int k, double* w, int n, const double* correction, double* h) {
+    if (!h) {
+        double ww = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:ww) if(n >= FUSED_PARALLEL_THRESHOLD)
+        for (int i = 0; i < n; ++i) {
+            double wi = w[i];
+            for (int j = 0; j < k; ++j) wi -= V[(size_t)j * n + i] * correction[j];
+            w[i] = wi;
+            ww += wi * wi;
+        }
+        return ww;
+    }
+    for (int j = 0; j < k; ++j) h[j] = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:h[:k]) if(n >= FUSED_PARALLEL_THRESHOLD)
+    for (int i = 0; i < n; ++i) {
+        double wi = w[i];
+        if (correction) {
+            for (int j = 0; j < k; ++j) wi -= V[(size_t)j * n + i] * correction[j];
+            w[i] = wi;
+        }
+        for (int j = 0; j < k; ++j) h[j] += V[(size_t)j * n + i] * wi;
+    }
+    return 0.0;
+}
+
+// Restarted GMRES(m), right preconditioned. The Arnoldi basis is orthogonalised with block
+// classical Gram-Schmidt and one reorthogonalisation (CGS2): three reductions per step,
+// independent of the basis size, instead of the j + 2 of modified Gram-Schmidt. Returns the
+// number of iterations performed, or -1 on a breakdown that a restart cannot get past; with
+// verbose == false only breakdowns are reported.
+int gmres(LinearOperator& A, const double* b, double* x, int n, int restart, int max_iterations, double tolerance, Preconditioner* precond = nullptr,
+          bool verbose = true) {
+    const int m = restart;
+    std::vector<double> V((size_t)(m + 1) * n), w(n), z(n);
+    std::vector<double> H((size_t)(m + 1) * m, 0.0), cs(m), sn(m), g(m + 1), h1(m + 1), h2(m + 1), y(m);
+    Vec xv(x, n), wv(w.data(), n), zv(z.data(), n);
+
+    int iterations = 0;
+    double residual = 0.0;
+    while (iterations < max_iterations) {
+        A.apply(x, w.data(), n);
+        Vec v0(V.data(), n);
+        const double beta = sqrt(fused(update(v0) = ConstVec(b, n) - wv, dot(v0, v0)));
+        residual = beta;
+        if (beta < tolerance) break;
+        v0 = (1.0 / beta) * v0;
+        std::fill(g.begin(), g.end(), 0.0);
+        g[0] = beta;
+
+        int k = 0;
+        bool breakdown = false;
+        for (; k < m && iterations < max_iterations; ++k, ++iterations) {
+            // w = A M^-1 v_k
+            const double* vk = &V[(size_t)k * n];
+            if (precond) {
+                precond->apply(vk, z.data(), n);
+                A.apply(z.data(), w.data(), n);
+            } else {
+                A.apply(vk, w.data(), n);
+            }
+            // CGS2: project, then subtract and reproject in one pass, then subtract again
+            // while accumulating the norm of the result
+            block_project(V.data(), k + 1, w.data(), n, nullptr, h1.data());
+            block_project(V.data(), k + 1, w.data(), n, h1.data(), h2.data());
+            const double ww = block_project(V.data(), k + 1, w.data(), n, h2.data(), nullptr);
+            double* hk = &H[(size_t)k * (m + 1)];
+            for (int j = 0; j <= k; ++j) hk[j] = h1[j] + h2[j];
+            hk[k + 1] = sqrt(ww);
+            Vec vnext(&V[(size_t)(k + 1) * n], n);
+            if (hk[k + 1] != 0.0) vnext = (1.0 / hk[k + 1]) * wv;
+
+            // Apply the previous Givens rotations to the new column and eliminate H(k+1, k)
+            for (int j = 0; j < k; ++j) {
+                const double t = cs[j] * hk[j] + sn[j] * hk[j + 1];
+                hk[j + 1] = -sn[j] * hk[j] + cs[j] * hk[j + 1];
+                hk[j] = t;
+            }
+            const double d = hypot(hk[k], hk[k + 1]);
+            if (d == 0.0) {
+                // The new column is zero after the rotations, so it cannot be eliminated:
+                // end the cycle with the first k columns and restart from the updated x
+                breakdown = true;
+                ++iterations;
+                break;
+            }
+            cs[k] = hk[k] / d;
+            sn[k] = hk[k + 1] / d;
+            hk[k] = d;
+            hk[k + 1] = 0.0;
+            g[k + 1] = -sn[k] * g[k];
+            g[k] = cs[k] * g[k];
+            residual = fabs(g[k + 1]);
+
+            if (iterations % 100 == 0 && verbose) std::cout << iterations << " residual " << residual << '\n';
+            if (residual < tolerance) {
+                ++k;
+                ++iterations;
+                break;
+            }
+        }
+
+        // x += M^-1 V y with H y = g
+        for (int i = k - 1; i >= 0; --i) {
+            double sum = g[i];
+            for (int j = i + 1; j < k; ++j) sum -= H[(size_t)j * (m + 1) + i] * y[j];
+            y[i] = sum / H[(size_t)i * (m + 1) + i];
+        }
+        std::fill(w.begin(), w.end(), 0.0);
+        for (int j = 0; j < k; ++j) wv += y[j] * Vec(&V[(size_t)j * n], n);
+        if (precond) {
+            precond->apply(w.data(), z.data(), n);
+            xv += zv;
+        } else {
+            xv += wv;
+        }
+        if (residual < tolerance) break;
+        if (breakdown && k == 0) {
+            std::cerr << "GMRES breakdown at iteration " << iterations << ": no progress after a restart" << std::endl;
+            return -1;
+        }
+    }
+    if (verbose) std::cout << "Final residual " << residual << std::endl;
+    return iterations;
+}
+
+// Number of eigenvalues of the symmetric tridiagonal (d, e) smaller than x (Sturm sequence)
+int tridiagonal_eigenvalues_below(const std::vector<double>& d, const std::vector<double>& e, double x) {
+    int count = 0;
+    double q = 1.0;
+    for (size_t i = 0; i < d.size(); ++i) {
+        q = d[i] - x - (i > 0 ? e[i - 1] * e[i - 1] / q : 0.0);
+        if (q == 0.0) q = 1e-300;
+        if (q < 0.0) ++count;
+    }
+    return count;
+}
+
+// k-th smallest eigenvalue (0-based) of a symmetric tridiagonal matrix by bisection
+double tridiagonal_eigenvalue(const std::vector<double>& d, const std::vector<double>& e, int k) {
+    double lo = 1e300, hi = -1e300;
+    for (size_t i = 0; i < d.size(); ++i) {
+        double radius = (i > 0 ? fabs(e[i - 1]) : 0.0) + (i + 1 < d.size() ? fabs(e[i]) : 0.0);
+        lo = std::min(lo, d[i] - radius);
+        hi = std::max(hi, d[i] + radius);
+    }
+    for (int it = 0; it < 200 && hi - lo > 1e-14 * std::max(fabs(lo), fabs(hi)); ++it) {
+        double mid = 0.5 * (lo + hi);
+        if (tridiagonal_eigenvalues_below(d, e, mid) > k) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return 0.5 * (lo + hi);
+}
+
+// Extreme eigenvalues of (M^-1)A estimated from the Lanczos matrix that CG builds for free:
+//   T(k,k) = 1/alpha_k + beta_{k-1}/alpha_{k-1},  T(k,k+1) = sqrt(beta_k)/alpha_k
+// The Ritz values converge from inside the spectrum, so lambda_min is an over- and lambda_max
+// an under-estimate; the outer ones converge within a few tens of iterations.
+struct SpectralEstimate {
+    double lambda_min = 0.0, lambda_max = 0.0, condition = 0.0;
+
+    // Classical bound on the CG iterations needed to reduce the A-norm error by `reduction`,
+    // 1/2 sqrt(kappa) ln(2/reduction); smooth right-hand sides usually converge faster
+    int predicted_iterations(double reduction) const {
+        return (int)ceil(0.5 * sqrt(condition) * log(2.0 / reduction));
+    }
+};
+
+SpectralEstimate lanczos_spectral_estimate(const CGHistory& history) {
+    SpectralEstimate estimate;
+    const size_t m = history.alpha.size();
+    if (m == 0) return estimate;
+    std::vector<double> d(m), e(m > 0 ? m - 1 : 0);
+    for (size_t k = 0; k < m; ++k) {
+        d[k] = 1.0 / history.alpha[k] + (k > 0 ? history.beta[k - 1] / history.alpha[k - 1] : 0.0);
+        if (k + 1 < m) e[k] = sqrt(history.beta[k]) / history.alpha[k];
+    }
+    estimate.lambda_min = tridiagonal_eigenvalue(d, e, 0);
+    estimate.lambda_max = tridiagonal_eigenvalue(d, e, m - 1);
+    estimate.condition = estimate.lambda_max / estimate.lambda_min;
+    return estimate;
+}
+
+// Chebyshev iteration for SPD A with spectrum inside [lambda_min, lambda_max].
+// Needs no inner products: the residual norm is only computed every check_interval
+// iterations to test for convergence. Returns the number of iterations performed, or -1 if
+// the bounds do not satisfy 0 < lambda_min < lambda_max.
+int chebyshev_iteration_csr(const double* values, const int* col_indices, const int* row_start, const double* b, double* x, int n,
+                            double lambda_min, double lambda_max, int max_iterations, double tolerance, int check_interval) {
+    if (!(0.0 < lambda_min && lambda_min < lambda_max)) {
+        std::cerr << "Chebyshev iteration: invalid spectrum bounds [" << lambda_min << ", " << lambda_max << "]" << std::endl;
+        return -1;
+    }
     double* r = new double[n];
-    double* p = new double[n];
-    double* Ap = new double[n];
-    double* Ax = new double[n];
+    double* d = new double[n];
+    double* Ad = new double[n];
+
+    const double theta = 0.5 * (lambda_max + lambda_min);
+    const double delta = 0.5 * (lambda_max - lambda_min);
+    const double sigma = theta / delta;
+    double rho = 1.0 / sigma;
+
+    // r = b - A*x, d = r / theta
+    matrix_vector_multiply_csr(values, col_indices, row_start, x, Ad, n);
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        r[i] = b[i] - Ad[i];
+        d[i] = r[i] / theta;
+    }
+
+    int iterations = max_iterations;
+    for (int k = 0; k < max_iterations; ++k) {
+        matrix_vector_multiply_csr(values, col_indices, row_start, d, Ad, n);
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            x[i] += d[i];
+            r[i] -= Ad[i];
+        }
+
+        if ((k + 1) % check_interval == 0) {
+            double rr = 0.0;
+            #pragma omp parallel for reduction(+:rr)
+            for (int i = 0; i < n; ++i) {
+                rr += r[i] * r[i];
+            }
+            if (sqrt(rr) < tolerance) {
+                std::cout << "Final residual " << sqrt(rr) << std::endl;
+                iterations = k + 1;
+                break;
+            } else if ((k + 1) % (100 * check_interval) == 0) {
+                std::cout << k + 1 << " residual " << sqrt(rr) << std::endl;
+            }
+        }
+
+        double rho_new = 1.0 / (2.0 * sigma - rho);
+        double c1 = rho_new * rho;
+        double c2 = 2.0 * rho_new / delta;
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            d[i] = c1 * d[i] + c2 * r[i];
+        }
+        rho = rho_new;
+    }
+
+    delete[] r;
+    delete[] d;
+    delete[] Ad;
+    return iterations;
+}
+
+// Gershgorin upper bound on lambda_max: max_i sum_j |a_ij|
+double gershgorin_lambda_max_csr(const double* values, const int* row_start, int n) {
+    double lambda = 0.0;
+    #pragma omp parallel for reduction(max:lambda)
+    for (int i = 0; i < n; ++i) {
+        double sum = 0.0;
+        for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+            sum += fabs(values[j]);
+        }
+        lambda = fmax(lambda, sum);
+    }
+    return lambda;
+}
+
+// Chebyshev polynomial preconditioner: z = p_degree(A) * r, where p is the Chebyshev
+// approximation of A^-1 on [lambda_min, lambda_max]. Applying it costs `degree` - 1 SpMVs
+// and no reductions, and p(A) is a fixed SPD operator, so it is valid inside CG.
+struct ChebyshevPreconditioner : Preconditioner {
+    const double* values;
+    const int* col_indices;
+    const int* row_start;
+    int degree;
+    double lambda_min, lambda_max;
+    std::vector<double> res, d, Ad;
+    long long spmvs = 0;
+
+    ChebyshevPreconditioner(const double* values, const int* col_indices, const int* row_start, int n,
+                            int degree, double lambda_min, double lambda_max)
+        : values(values), col_indices(col_indices), row_start(row_start), degree(degree),
+          lambda_min(lambda_min), lambda_max(lambda_max), res(n), d(n), Ad(n) {
+        if (!(0.0 < lambda_min && lambda_min < lambda_max)) {
+            std::cerr << "ChebyshevPreconditioner: invalid spectrum bounds [" << lambda_min << ", " << lambda_max << "]" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    void apply(const double* r, double* z, int n) override {
+        const double theta = 0.5 * (lambda_max + lambda_min);
+        const double delta = 0.5 * (lambda_max - lambda_min);
+        const double sigma = theta / delta;
+        double rho = 1.0 / sigma;
+
+        // First term with z0 = 0: z = r / theta
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            res[i] = r[i];
+            d[i] = r[i] / theta;
+            z[i] = 0.0;
+        }
+        for (int k = 0; k < degree; ++k) {
+            #pragma omp parallel for
+            for (int i = 0; i < n; ++i) {
+                z[i] += d[i];
+            }
+            if (k == degree - 1) break;
+            matrix_vector_multiply_csr(values, col_indices, row_start, d.data(), Ad.data(), n);
+            spmvs++;
+            double rho_new = 1.0 / (2.0 * sigma - rho);
+            double c1 = rho_new * rho;
+            double c2 = 2.0 * rho_new / delta;
+            #pragma omp parallel for
+            for (int i = 0; i < n; ++i) {
+                res[i] -= Ad[i];
+                d[i] = c1 * d[i] + c2 * res[i];
+            }
+            rho = rho_new;
+        }
+    }
+};
+
+void matrix_vector_multiply_csr(const double* values, const int* col_indices, const int* row_start, const double* x, double* result, int n) {
+    for (int i = 0; i < n; ++i) {
+        double sum = 0.0;
+        for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+            sum += values[j] * x[col_indices[j]];
+        }
+        result[i] = sum;
+    }
+}
+
+// Rows of length 1..MAX_FIXED_ROW_LENGTH get a fully unrolled kernel, longer rows the generic loop
+const int MAX_FIXED_ROW_LENGTH = 8;
+
+// SpMV over a list of rows that all have exactly L nonzeros. The sum stays in a register and
+// the x entries of the row `prefetch_distance` ahead are prefetched, since the hardware
+// prefetcher cannot predict the gather.
+template <int L>
+void spmv_fixed_length_rows(const double* values, const int* col_indices, const int* row_start, const int* rows, int count,
+                            const double* x, double* result, int prefetch_distance) {
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < count; ++k) {
+        if (prefetch_distance > 0 && k + prefetch_distance < count) {
+            const int ahead = row_start[rows[k + prefetch_distance]];
+            __builtin_prefetch(&x[col_indices[ahead]]);
+            __builtin_prefetch(&x[col_indices[ahead + L - 1]]);
+        }
+        const int row = rows[k];
+        const int j0 = row_start[row];
+        double sum = 0.0;
+        for (int l = 0; l < L; ++l) {
+            sum += values[j0 + l] * x[col_indices[j0 + l]];
+        }
+        result[row] = sum;
+    }
+}
+
+void spmv_generic_rows(const double* values, const int* col_indices, const int* row_start, const int* rows, int count,
+                       const double* x, double* result) {
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int k = 0; k < count; ++k) {
+        const int row = rows[k];
+        double sum = 0.0;
+        for (int j = row_start[row]; j < row_start[row + 1]; ++j) {
+            sum += values[j] * x[col_indices[j]];
+        }
+        result[row] = sum;
+    }
+}
+
+// CSR rows binned by length in a preprocessing pass. Bin L (1..MAX_FIXED_ROW_LENGTH) runs the
+// kernel specialised for L with its own tuned prefetch distance; bin 0 holds empty rows and
+// the generic bin everything longer.
+struct BinnedCSRMatrix {
+    const double* values;
+    const int* col_indices;
+    const int* row_start;
+    int n;
+    std::vector<int> bins[MAX_FIXED_ROW_LENGTH + 1];
+    std::vector<int> generic_rows;
+    int prefetch_distance[MAX_FIXED_ROW_LENGTH + 1];
+
+    BinnedCSRMatrix(const double* values, const int* col_indices, const int* row_start, int n)
+        : values(values), col_indices(col_indices), row_start(row_start), n(n) {
+        for (int i = 0; i < n; ++i) {
+            int length = row_start[i + 1] - row_start[i];
+            if (length <= MAX_FIXED_ROW_LENGTH) {
+                bins[length].push_back(i);
+            } else {
+                generic_rows.push_back(i);
+            }
+        }
+        for (int L = 0; L <= MAX_FIXED_ROW_LENGTH; ++L) {
+            prefetch_distance[L] = 16;
+        }
+    }
+
+    void multiply_bin(int L, const double* x, double* result, int distance) const {
+        const int* rows = bins[L].data();
+        const int count = bins[L].size();
+        switch (L) {
+        case 0:
+            for (int k = 0; k < count; ++k) result[rows[k]] = 0.0;
+            break;
+        case 1: spmv_fixed_length_rows<1>(values, col_indices, row_start, rows, count, x, result, distance); break;
+        case 2: spmv_fixed_length_rows<2>(values, col_indices, row_start, rows, count, x, result, distance); break;
+        case 3: spmv_fixed_length_rows<3>(values, col_indices, row_start, rows, count, x, result, distance); break;
+        case 4: spmv_fixed_length_rows<4>(values, col_indices, row_start, rows, count, x, result, distance); break;
+        case 5: spmv_fixed_length_rows<5>(values, col_indices, row_start, rows, count, x, result, distance); break;
+        case 6: spmv_fixed_length_rows<6>(values, col_indices, row_start, rows, count, x, result, distance); break;
+        case 7: spmv_fixed_length_rows<7>(values, col_indices, row_start, rows, count, x, result, distance); break;
+        case 8: spmv_fixed_length_rows<8>(values, col_indices, row_start, rows, count, x, result, distance); break;
+        }
+    }
+
+    void multiply(const double* x, double* result) const {
+        for (int L = 0; L <= MAX_FIXED_ROW_LENGTH; ++L) {
+            if (!bins[L].empty()) multiply_bin(L, x, result, prefetch_distance[L]);
+        }
+        if (!generic_rows.empty()) {
+            spmv_generic_rows(values, col_indices, row_start, generic_rows.data(), generic_rows.size(), x, result);
+        }
+    }
+
+    // Picks the fastest prefetch distance per bin by timing a few SpMVs with each candidate
+    void tune_prefetch(const double* x, double* result, int repetitions = 5) {
+        const int candidates[] = {0, 4, 8, 16, 32, 64};
+        for (int L = 1; L <= MAX_FIXED_ROW_LENGTH; ++L) {
+            if (bins[L].empty()) continue;
+            double best_time = 1e30;
+            for (int distance : candidates) {
+                auto t1 = std::chrono::high_resolution_clock::now();
+                for (int rep = 0; rep < repetitions; ++rep) {
+                    multiply_bin(L, x, result, distance);
+                }
+                auto t2 = std::chrono::high_resolution_clock::now();
+                double time = std::chrono::duration<double>(t2 - t1).count();
+                if (time < best_time) {
+                    best_time = time;
+                    prefetch_distance[L] = distance;
+                }
+            }
+        }
+    }
+
+    // Per-bin rows, nonzeros, prefetch distance and throughput
+    void report(const double* x, double* result, int repetitions = 10) const {
+        for (int L = 1; L <= MAX_FIXED_ROW_LENGTH + 1; ++L) {
+            const bool generic = L > MAX_FIXED_ROW_LENGTH;
+            const std::vector<int>& rows = generic ? generic_rows : bins[L];
+            if (rows.empty()) continue;
+            long long nnz = 0;
+            for (int row : rows) nnz += row_start[row + 1] - row_start[row];
+            auto t1 = std::chrono::high_resolution_clock::now();
+            for (int rep = 0; rep < repetitions; ++rep) {
+                if (generic) {
+                    spmv_generic_rows(values, col_indices, row_start, rows.data(), rows.size(), x, result);
+                } else {
+                    multiply_bin(L, x, result, prefetch_distance[L]);
+                }
+            }
+            auto t2 = std::chrono::high_resolution_clock::now();
+            double time = std::chrono::duration<double>(t2 - t1).count() / repetitions;
+            // values + col_indices + x gather per nonzero; row index, row pointer and result per row
+            double bytes = 20.0 * nnz + 16.0 * rows.size();
+            std::cout << "  bin " << (generic ? std::string(">") + std::to_string(MAX_FIXED_ROW_LENGTH) : std::to_string(L))
+                      << ": rows " << rows.size() << ", nnz " << nnz
+                      << ", prefetch " << (generic ? 0 : prefetch_distance[L])
+                      << ", " << 2.0 * nnz / time / 1e9 << " GFLOP/s, " << bytes / time / 1e9 << " GB/s" << std::endl;
+        }
+    }
+};
+
+struct BinnedCSROperator : LinearOperator {
+    BinnedCSRMatrix matrix;
+
+    BinnedCSROperator(const double* values, const int* col_indices, const int* row_start, int n)
+        : matrix(values, col_indices, row_start, n) {}
+
+    void apply(const double* x, double* y, int /*n*/) override {
+        matrix.multiply(x, y);
+    }
+};
+
+
+// DIA storage: diagonal d holds A(i, i + offsets[d]) in data[d*n + i], zero-padded where
+// the diagonal runs off the matrix or the entry is absent.
+struct DIAMatrix {
+    int n = 0;
+    std::vector<int> offsets;
+    std::vector<double> data;
+};
+
+// Detects the distinct diagonals of a CSR matrix. Returns false when the matrix is not
+// banded enough for DIA: more than max_diagonals diagonals, or the padded storage would
+// exceed max_fill times the number of nonzeros.
+bool analyse_diagonals_csr(const int* col_indices, const int* row_start, int n, std::vector<int>& offsets,
+                           int max_diagonals = 16, double max_fill = 1.5) {
+    offsets.clear();
+    for (int i = 0; i < n; ++i) {
+        for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+            int offset = col_indices[j] - i;
+            if (std::find(offsets.begin(), offsets.end(), offset) == offsets.end()) {
+                offsets.push_back(offset);
+                if ((int)offsets.size() > max_diagonals) return false;
+            }
+        }
+    }
+    std::sort(offsets.begin(), offsets.end());
+    double stored = (double)offsets.size() * n;
+    return stored <= max_fill * row_start[n];
+}
+
+bool csr_to_dia(const double* values, const int* col_indices, const int* row_start, int n, DIAMatrix& dia,
+                int max_diagonals = 16, double max_fill = 1.5) {
+    if (!analyse_diagonals_csr(col_indices, row_start, n, dia.offsets, max_diagonals, max_fill)) return false;
+    const int ndiag = dia.offsets.size();
+    dia.n = n;
+    dia.data.assign((size_t)ndiag * n, 0.0);
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+            int d = std::lower_bound(dia.offsets.begin(), dia.offsets.end(), col_indices[j] - i) - dia.offsets.begin();
+            dia.data[(size_t)d * n + i] += values[j];
+        }
+    }
+    return true;
+}
+
+// Row-blocked DIA SpMV: every diagonal is streamed with unit stride into a block of y that
+// stays in cache, with no column-index loads or gathers.
+void matrix_vector_multiply_dia(const DIAMatrix& dia, const double* x, double* result) {
+    const int n = dia.n;
+    const int ndiag = dia.offsets.size();
+    const int block = 4096;
+    #pragma omp parallel for schedule(static)
+    for (int start = 0; start < n; start += block) {
+        const int end = std::min(start + block, n);
+        double* y = result + start;
+        #pragma omp simd
+        for (int i = 0; i < end - start; ++i) {
+            y[i] = 0.0;
+        }
+        for (int d = 0; d < ndiag; ++d) {
+            const int offset = dia.offsets[d];
+            // Clip the row range so that i + offset stays inside [0, n)
+            const int lo = std::max(start, -offset);
+            const int hi = std::min(end, n - offset);
+            const double* a = dia.data.data() + (size_t)d * n;
+            const double* xs = x + offset;
+            #pragma omp simd
+            for (int i = lo; i < hi; ++i) {
+                result[i] += a[i] * xs[i];
+            }
+        }
+    }
+}
+
+// Uses DIA when the analyser accepts the matrix and falls back to CSR otherwise
+struct StencilOperator : LinearOperator {
+    CSROperator csr;
+    DIAMatrix dia;
+    bool use_dia;
+
+    StencilOperator(const double* values, const int* col_indices, const int* row_start, int n)
+        : csr(values, col_indices, row_start) {
+        use_dia = csr_to_dia(values, col_indices, row_start, n, dia);
+    }
+
+    void apply(const double* x, double* y, int n) override {
+        if (use_dia) {
+            matrix_vector_multiply_dia(dia, x, y);
+        } else {
+            csr.apply(x, y, n);
+        }
+    }
+};
+
+// Value-dictionary CSR: the distinct coefficients are stored once and each nonzero keeps a
+// 1-byte index into that table instead of an 8-byte double. Column indices and row
+// pointers are shared with the original CSR arrays.
+struct DictCSRMatrix {
+    std::vector<double> dictionary;
+    std::vector<uint8_t> value_index;
+    const int* col_indices = nullptr;
+    const int* row_start = nullptr;
+};
+
+// Returns false if the matrix has more than 256 distinct values
+bool csr_to_dict(const double* values, const int* col_indices, const int* row_start, int n, DictCSRMatrix& dict) {
+    const int nnz = row_start[n];
+    std::unordered_map<double, int> lookup;
+    dict.dictionary.clear();
+    dict.value_index.resize(nnz);
+    for (int j = 0; j < nnz; ++j) {
+        auto it = lookup.find(values[j]);
+        if (it == lookup.end()) {
+            if (dict.dictionary.size() == 256) return false;
+            it = lookup.emplace(values[j], (int)dict.dictionary.size()).first;
+            dict.dictionary.push_back(values[j]);
+        }
+        dict.value_index[j] = (uint8_t)it->second;
+    }
+    dict.col_indices = col_indices;
+    dict.row_start = row_start;
+    return true;
+}
+
+void matrix_vector_multiply_dict_csr(const DictCSRMatrix& dict, const double* x, double* result, int n) {
+    const double* table = dict.dictionary.data();
+    const uint8_t* index = dict.value_index.data();
+    const int* col_indices = dict.col_indices;
+    const int* row_start = dict.row_start;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; ++i) {
+        double sum = 0.0;
+        for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+            sum += table[index[j]] * x[col_indices[j]];
+        }
+        result[i] = sum;
+    }
+}
+
+// Uses the dictionary format when the matrix has few enough distinct values, CSR otherwise
+struct DictCSROperator : LinearOperator {
+    CSROperator csr;
+    DictCSRMatrix dict;
+    bool use_dict;
+
+    DictCSROperator(const double* values, const int* col_indices, const int* row_start, int n)
+        : csr(values, col_indices, row_start) {
+        use_dict = csr_to_dict(values, col_indices, row_start, n, dict);
+    }
+
+    void apply(const double* x, double* y, int n) override {
+        if (use_dict) {
+            matrix_vector_multiply_dict_csr(dict, x, y, n);
+        } else {
+            csr.apply(x, y, n);
+        }
+    }
+};
+
+// Jones-Plassmann colouring of the CSR adjacency graph. Every round, each uncoloured vertex
+// whose random weight beats all uncoloured neighbours takes the smallest colour unused by
+// its neighbours; those vertices form an independent set, so a round runs fully in parallel.
+// Returns the number of colours.
+int jones_plassmann_colouring_csr(const int* col_indices, const int* row_start, int n, std::vector<int>& colour) {
+    std::vector<unsigned> weight(n);
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        // Integer hash as a deterministic pseudo-random weight
+        unsigned h = (unsigned)i * 2654435761u;
+        h ^= h >> 16;
+        h *= 0x45d9f3bu;
+        h ^= h >> 16;
+        weight[i] = h;
+    }
+    colour.assign(n, -1);
+    std::vector<char> selected(n);
+    int remaining = n;
+    while (remaining > 0) {
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; ++i) {
+            selected[i] = 0;
+            if (colour[i] >= 0) continue;
+            bool local_max = true;
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                int k = col_indices[j];
+                if (k == i || colour[k] >= 0) continue;
+                if (weight[k] > weight[i] || (weight[k] == weight[i] && k > i)) {
+                    local_max = false;
+                    break;
+                }
+            }
+            selected[i] = local_max;
+        }
+        int coloured = 0;
+        #pragma omp parallel for schedule(static) reduction(+:coloured)
+        for (int i = 0; i < n; ++i) {
+            if (!selected[i]) continue;
+            // Smallest colour not taken by a neighbour; neighbours are never selected in the same round
+            uint64_t used = 0;
+            int c = 0;
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                int ck = col_indices[j] != i ? colour[col_indices[j]] : -1;
+                if (ck >= 0 && ck < 64) used |= (uint64_t)1 << ck;
+            }
+            while (c < 64 && (used >> c) & 1) ++c;
+            if (c == 64) {
+                // Very high degree vertex: fall back to a linear scan
+                for (bool clash = true; clash; ) {
+                    clash = false;
+                    for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                        if (col_indices[j] != i && colour[col_indices[j]] == c) {
+                            clash = true;
+                            ++c;
+                            break;
+                        }
+                    }
+                }
+            }
+            colour[i] = c;
+            ++coloured;
+        }
+        remaining -= coloured;
+    }
+    int colours = 0;
+    for (int i = 0; i < n; ++i) {
+        colours = std::max(colours, colour[i] + 1);
+    }
+    return colours;
+}
+
+// Speculative parallel greedy colouring (Gebremedhin-Manne): every thread colours its rows
+// first-fit, then vertices that ended up with the same colour as a lower-numbered neighbour
+// are recoloured in the next round. Usually needs fewer colours than Jones-Plassmann (two
+// for the 5-point stencil). Returns the number of colours.
+int greedy_colouring_csr(const int* col_indices, const int* row_start, int n, std::vector<int>& colour) {
+    colour.assign(n, -1);
+    std::vector<int> work(n), conflicts;
+    for (int i = 0; i < n; ++i) work[i] = i;
+    while (!work.empty()) {
+        const int count = work.size();
+        #pragma omp parallel for schedule(static)
+        for (int k = 0; k < count; ++k) {
+            const int i = work[k];
+            int c = 0;
+            // Neighbours may be recoloured concurrently by other threads; the accesses are
+            // atomic so the speculation is race-free, and the pass below repairs conflicts
+            for (bool clash = true; clash; ) {
+                clash = false;
+                for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                    if (col_indices[j] == i) continue;
+                    int neighbour_colour;
+                    #pragma omp atomic read
+                    neighbour_colour = colour[col_indices[j]];
+                    if (neighbour_colour == c) {
+                        clash = true;
+                        ++c;
+                        break;
+                    }
+                }
+            }
+            #pragma omp atomic write
+            colour[i] = c;
+        }
+        conflicts.clear();
+        #pragma omp parallel
+        {
+            std::vector<int> local;
+            #pragma omp for schedule(static) nowait
+            for (int k = 0; k < count; ++k) {
+                const int i = work[k];
+                for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                    if (col_indices[j] < i && colour[col_indices[j]] == colour[i]) {
+                        local.push_back(i);
+                        break;
+                    }
+                }
+            }
+            #pragma omp critical
+            conflicts.insert(conflicts.end(), local.begin(), local.end());
+        }
+        work.swap(conflicts);
+    }
+    int colours = 0;
+    for (int i = 0; i < n; ++i) {
+        colours = std::max(colours, colour[i] + 1);
+    }
+    return colours;
+}
+
+// Multicolour symmetric Gauss-Seidel: z = (D+U)^-1 D (D+L)^-1 r with the unknowns ordered by
+// colour. Rows of one colour have no couplings between them, so each colour sweeps in parallel.
+struct MulticolourSGSPreconditioner : Preconditioner {
+    const double* values;
+    const int* col_indices;
+    const int* row_start;
+    int colours;
+    std::vector<int> colour_start;   // rows of colour c are colour_rows[colour_start[c] .. colour_start[c+1])
+    std::vector<int> colour_rows;
+    std::vector<double> inv_diag;
+    double apply_seconds = 0.0;
+    int applications = 0;
+
+    MulticolourSGSPreconditioner(const double* values, const int* col_indices, const int* row_start, int n, bool jones_plassmann = false)
+        : values(values), col_indices(col_indices), row_start(row_start), inv_diag(n) {
+        std::vector<int> colour;
+        colours = jones_plassmann ? jones_plassmann_colouring_csr(col_indices, row_start, n, colour)
+                                  : greedy_colouring_csr(col_indices, row_start, n, colour);
+        colour_start.assign(colours + 1, 0);
+        for (int i = 0; i < n; ++i) colour_start[colour[i] + 1]++;
+        for (int c = 0; c < colours; ++c) colour_start[c + 1] += colour_start[c];
+        colour_rows.resize(n);
+        std::vector<int> fill(colour_start.begin(), colour_start.end() - 1);
+        for (int i = 0; i < n; ++i) colour_rows[fill[colour[i]]++] = i;
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            double diag = 0.0;
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                if (col_indices[j] == i) diag += values[j];
+            }
+            inv_diag[i] = 1.0 / diag;
+        }
+    }
+
+    void sweep_colour(int c, const double* r, double* z) {
+        #pragma omp parallel for schedule(static)
+        for (int k = colour_start[c]; k < colour_start[c + 1]; ++k) {
+            const int i = colour_rows[k];
+            double sum = r[i];
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                if (col_indices[j] != i) sum -= values[j] * z[col_indices[j]];
+            }
+            z[i] = sum * inv_diag[i];
+        }
+    }
+
+    void apply(const double* r, double* z, int n) override {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            z[i] = 0.0;
+        }
+        for (int c = 0; c < colours; ++c) {
+            sweep_colour(c, r, z);
+        }
+        for (int c = colours - 1; c >= 0; --c) {
+            sweep_colour(c, r, z);
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+        apply_seconds += std::chrono::duration<double>(t2 - t1).count();
+        applications++;
+    }
+};
+
+enum class LocalSolver { ilu0, banded_cholesky };
+
+// Largest band (m*(bandwidth+1) doubles, 128 MB) a Schwarz block factorises with banded
+// Cholesky; the cost grows as m*bandwidth^2, so wider blocks fall back to ILU(0)
+const size_t BANDED_CHOLESKY_MAX_ENTRIES = (size_t)1 << 24;
+
+// One subdomain of the additive Schwarz preconditioner: the owned rows [lo, hi) extended by
+// the overlap to [ext_lo, ext_hi), with the local matrix (couplings outside the extended
+// range dropped) factorised either as ILU(0) in CSR or as an exact banded Cholesky.
+struct SchwarzBlock {
+    int lo, hi, ext_lo, ext_hi;
+    LocalSolver solver = LocalSolver::ilu0;
+    int missing_diagonal = -1;     // first local row without a diagonal entry, -1 if none
+    std::vector<int> row_start, col_indices, diag_pos;
+    std::vector<double> values;
+    int bandwidth = 0;
+    std::vector<double> band;      // band[i*(bandwidth+1) + d] = L(i, i-d)
+    std::vector<double> solution;
+
+    void extract(const double* a_values, const int* a_col_indices, const int* a_row_start) {
+        const int m = ext_hi - ext_lo;
+        row_start.assign(m + 1, 0);
+        diag_pos.assign(m, -1);
+        col_indices.clear();
+        values.clear();
+        std::vector<std::pair<int, double>> row;
+        for (int i = 0; i < m; ++i) {
+            row.clear();
+            const int gi = ext_lo + i;
+            for (int j = a_row_start[gi]; j < a_row_start[gi + 1]; ++j) {
+                int c = a_col_indices[j];
+                if (c >= ext_lo && c < ext_hi) row.push_back({c - ext_lo, a_values[j]});
+            }
+            std::sort(row.begin(), row.end());
+            for (auto& entry : row) {
+                if (entry.first == i) diag_pos[i] = col_indices.size();
+                col_indices.push_back(entry.first);
+                values.push_back(entry.second);
+                bandwidth = std::max(bandwidth, i - entry.first);
+            }
+            row_start[i + 1] = col_indices.size();
+            if (diag_pos[i] < 0 && missing_diagonal < 0) missing_diagonal = i;
+        }
+        solution.resize(m);
+    }
+
+    // ILU(0) in place: L (unit lower) and U share the sparsity pattern of the local matrix
+    void factorise_ilu0() {
+        const int m = ext_hi - ext_lo;
+        solver = LocalSolver::ilu0;
+        std::vector<int> position(m, -1);
+        for (int i = 0; i < m; ++i) {
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                position[col_indices[j]] = j;
+            }
+            for (int j = row_start[i]; j < row_start[i + 1] && col_indices[j] < i; ++j) {
+                const int k = col_indices[j];
+                values[j] /= values[diag_pos[k]];
+                for (int jk = diag_pos[k] + 1; jk < row_start[k + 1]; ++jk) {
+                    int p = position[col_indices[jk]];
+                    if (p >= 0) values[p] -= values[j] * values[jk];
+                }
+            }
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                position[col_indices[j]] = -1;
+            }
+        }
+    }
+
+    // Falls back to ILU(0) (and returns false) when the band exceeds BANDED_CHOLESKY_MAX_ENTRIES
+    bool factorise_banded_cholesky() {
+        const int m = ext_hi - ext_lo;
+        const int w = bandwidth + 1;
+        if ((size_t)m * w > BANDED_CHOLESKY_MAX_ENTRIES) {
+            factorise_ilu0();
+            return false;
+        }
+        solver = LocalSolver::banded_cholesky;
+        band.assign((size_t)m * w, 0.0);
+        for (int i = 0; i < m; ++i) {
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                if (col_indices[j] <= i) band[(size_t)i * w + (i - col_indices[j])] = values[j];
+            }
+        }
+        for (int i = 0; i < m; ++i) {
+            for (int j = std::max(0, i - bandwidth); j <= i; ++j) {
+                double sum = band[(size_t)i * w + (i - j)];
+                for (int k = std::max(0, i - bandwidth); k < j; ++k) {
+                    sum -= band[(size_t)i * w + (i - k)] * band[(size_t)j * w + (j - k)];
+                }
+                band[(size_t)i * w + (i - j)] = i == j ? sqrt(sum) : sum / band[(size_t)j * w];
+            }
+        }
+        return true;
+    }
+
+    // solution = M_local^-1 * r[ext_lo, ext_hi)
+    void solve(const double* r) {
+        const int m = ext_hi - ext_lo;
+        double* y = solution.data();
+        if (solver == LocalSolver::ilu0) {
+            for (int i = 0; i < m; ++i) {
+                double sum = r[ext_lo + i];
+                for (int j = row_start[i]; j < diag_pos[i]; ++j) {
+                    sum -= values[j] * y[col_indices[j]];
+                }
+                y[i] = sum;
+            }
+            for (int i = m - 1; i >= 0; --i) {
+                double sum = y[i];
+                for (int j = diag_pos[i] + 1; j < row_start[i + 1]; ++j) {
+                    sum -= values[j] * y[col_indices[j]];
+                }
+                y[i] = sum / values[diag_pos[i]];
+            }
+        } else {
+            const int w = bandwidth + 1;
+            for (int i = 0; i < m; ++i) {
+                double sum = r[ext_lo + i];
+                for (int k = std::max(0, i - bandwidth); k < i; ++k) {
+                    sum -= band[(size_t)i * w + (i - k)] * y[k];
+                }
+                y[i] = sum / band[(size_t)i * w];
+            }
+            for (int i = m - 1; i >= 0; --i) {
+                double sum = y[i];
+                for (int k = i + 1; k <= std::min(m - 1, i + bandwidth); ++k) {
+                    sum -= band[(size_t)k * w + (k - i)] * y[k];
+                }
+                y[i] = sum / band[(size_t)i * w];
+            }
+        }
+    }
+};
+
+// Block-Jacobi (overlap = 0) / additive Schwarz preconditioner with one contiguous row block
+// per thread. Every thread factorises and solves its own block. Without overlap the threads
+// write disjoint parts of z and never synchronise; with overlap the local solutions are
+// summed over the shared rows after one barrier, which keeps the operator symmetric for CG.
+struct SchwarzPreconditioner : Preconditioner {
+    std::vector<SchwarzBlock> blocks;
+    LocalSolver solver;
+    int overlap;
+    int fallback_blocks = 0;       // blocks whose band was too wide for banded Cholesky
+
+    SchwarzPreconditioner(const double* values, const int* col_indices, const int* row_start, int n,
+                          int overlap = 0, LocalSolver solver = LocalSolver::ilu0, int nblocks = omp_get_max_threads())
+        : blocks(nblocks), solver(solver), overlap(overlap) {
+        // Overlap only reaches into the neighbouring blocks
+        this->overlap = std::min(overlap, n / nblocks);
+        #pragma omp parallel for schedule(static, 1)
+        for (int b = 0; b < nblocks; ++b) {
+            SchwarzBlock& block = blocks[b];
+            block.lo = (long long)n * b / nblocks;
+            block.hi = (long long)n * (b + 1) / nblocks;
+            block.ext_lo = std::max(0, block.lo - this->overlap);
+            block.ext_hi = std::min(n, block.hi + this->overlap);
+            block.extract(values, col_indices, row_start);
+            if (block.missing_diagonal >= 0) continue;
+            if (solver == LocalSolver::ilu0) {
+                block.factorise_ilu0();
+            } else if (!block.factorise_banded_cholesky()) {
+                #pragma omp atomic
+                fallback_blocks++;
+            }
+        }
+        for (const SchwarzBlock& block : blocks) {
+            if (block.missing_diagonal >= 0) {
+                std::cerr << "SchwarzPreconditioner: row " << block.ext_lo + block.missing_diagonal
+                          << " has no diagonal entry" << std::endl;
+                std::exit(1);
+            }
+        }
+    }
+
+    void apply(const double* r, double* z, int /*n*/) override {
+        const int nblocks = blocks.size();
+        if (overlap == 0) {
+            #pragma omp parallel for schedule(static, 1)
+            for (int b = 0; b < nblocks; ++b) {
+                SchwarzBlock& block = blocks[b];
+                block.solve(r);
+                std::copy(block.solution.begin(), block.solution.end(), z + block.lo);
+            }
+            return;
+        }
+        #pragma omp parallel
+        {
+            #pragma omp for schedule(static, 1)
+            for (int b = 0; b < nblocks; ++b) {
+                blocks[b].solve(r);
+            }
+            #pragma omp for schedule(static, 1)
+            for (int b = 0; b < nblocks; ++b) {
+                const SchwarzBlock& block = blocks[b];
+                for (int i = block.lo; i < block.hi; ++i) {
+                    double sum = block.solution[i - block.ext_lo];
+                    if (b > 0 && i < blocks[b - 1].ext_hi) sum += blocks[b - 1].solution[i - blocks[b - 1].ext_lo];
+                    if (b + 1 < nblocks && i >= blocks[b + 1].ext_lo) sum += blocks[b + 1].solution[i - blocks[b + 1].ext_lo];
+                    z[i] = sum;
+                }
+            }
+        }
+    }
+};
+
+// Storage budget of the batched-cg driver; larger batches are capped to fit
+const size_t BATCHED_CG_MAX_BYTES = (size_t)2 << 30;
+
+// Batched CG for many small SPD systems sharing one sparsity pattern. A batch of W systems is
+// stored interleaved by SIMD lane: values[j*W + l] is nonzero j of system l and x[i*W + l] is
+// entry i of system l, so every inner loop runs over W contiguous lanes and vectorises.
+// Converged lanes are masked out (their step size is zeroed, by select so a lane with a zero
+// residual cannot produce 0/0) until the whole batch is done; lanes that start converged report 0.
+// `work` must hold 4*n*W doubles. Per-lane iteration counts go to lane_iterations.
+template <int W>
+void batched_conjugate_gradient_interleaved(const double* values, const int* col_indices, const int* row_start,
+                                            const double* b, double* x, int n, int max_iterations, double tolerance,
+                                            int* lane_iterations, double* work) {
+    double* r = work;
+    double* p = work + (size_t)n * W;
+    double* Ap = work + (size_t)2 * n * W;
+    double* Ax = work + (size_t)3 * n * W;
+    double rsold[W], active[W];
+
+    auto spmv = [&](const double* v, double* result) {
+        for (int i = 0; i < n; ++i) {
+            double sum[W] = {};
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                const double* a = values + (size_t)j * W;
+                const double* vc = v + (size_t)col_indices[j] * W;
+                #pragma omp simd
+                for (int l = 0; l < W; ++l) sum[l] += a[l] * vc[l];
+            }
+            #pragma omp simd
+            for (int l = 0; l < W; ++l) result[(size_t)i * W + l] = sum[l];
+        }
+    };
+
+    spmv(x, Ax);
+    for (int l = 0; l < W; ++l) {
+        rsold[l] = 0.0;
+        active[l] = 1.0;
+        lane_iterations[l] = max_iterations;
+    }
+    for (int i = 0; i < n; ++i) {
+        #pragma omp simd
+        for (int l = 0; l < W; ++l) {
+            const size_t k = (size_t)i * W + l;
+            r[k] = b[k] - Ax[k];
+            p[k] = r[k];
+            rsold[l] += r[k] * r[k];
+        }
+    }
+    // Lanes that start converged (b = 0, an exact initial guess, padding) never take a step
+    int remaining = 0;
+    for (int l = 0; l < W; ++l) {
+        if (sqrt(rsold[l]) < tolerance) {
+            active[l] = 0.0;
+            lane_iterations[l] = 0;
+        }
+        remaining += active[l] != 0.0;
+    }
+    if (remaining == 0) return;
+
+    for (int it = 0; it < max_iterations; ++it) {
+        spmv(p, Ap);
+        double pAp[W] = {}, alpha[W], rsnew[W] = {};
+        for (int i = 0; i < n; ++i) {
+            #pragma omp simd
+            for (int l = 0; l < W; ++l) pAp[l] += p[(size_t)i * W + l] * Ap[(size_t)i * W + l];
+        }
+        #pragma omp simd
+        for (int l = 0; l < W; ++l) alpha[l] = active[l] != 0.0 ? rsold[l] / pAp[l] : 0.0;
+        for (int i = 0; i < n; ++i) {
+            #pragma omp simd
+            for (int l = 0; l < W; ++l) {
+                const size_t k = (size_t)i * W + l;
+                x[k] += alpha[l] * p[k];
+                r[k] -= alpha[l] * Ap[k];
+                rsnew[l] += r[k] * r[k];
+            }
+        }
+        remaining = 0;
+        for (int l = 0; l < W; ++l) {
+            if (active[l] != 0.0 && sqrt(rsnew[l]) < tolerance) {
+                active[l] = 0.0;
+                lane_iterations[l] = it + 1;
+            }
+            remaining += active[l] != 0.0;
+        }
+        if (remaining == 0) break;
+        double beta[W];
+        #pragma omp simd
+        for (int l = 0; l < W; ++l) {
+            // Converged lanes keep rsold and are never updated again
+            beta[l] = active[l] != 0.0 ? rsnew[l] / rsold[l] : 0.0;
+            rsold[l] = active[l] != 0.0 ? rsnew[l] : rsold[l];
+        }
+        for (int i = 0; i < n; ++i) {
+            #pragma omp simd
+            for (int l = 0; l < W; ++l) {
+                const size_t k = (size_t)i * W + l;
+                p[k] = r[k] + beta[l] * p[k];
+            }
+        }
+    }
+}
+
+// Solves nsystems systems given system-major (values[s*nnz + j], b[s*n + i], x[s*n + i]).
+// Each thread packs W systems at a time into lane-interleaved buffers, solves them together
+// and unpacks x; the last batch is padded by repeating its final system.
+template <int W>
+void batched_conjugate_gradient_csr(const double* values, const int* col_indices, const int* row_start,
+                                    const double* b, double* x, int n, int nsystems, int max_iterations,
+                                    double tolerance, int* iterations) {
+    const int nnz = row_start[n];
+    const int nbatches = (nsystems + W - 1) / W;
+    #pragma omp parallel
+    {
+        std::vector<double> batch_values((size_t)nnz * W), batch_b((size_t)n * W), batch_x((size_t)n * W);
+        std::vector<double> work((size_t)4 * n * W);
+        int lane_iterations[W];
+        #pragma omp for schedule(dynamic)
+        for (int batch = 0; batch < nbatches; ++batch) {
+            for (int l = 0; l < W; ++l) {
+                const int s = std::min(batch * W + l, nsystems - 1);
+                for (int j = 0; j < nnz; ++j) batch_values[(size_t)j * W + l] = values[(size_t)s * nnz + j];
+                for (int i = 0; i < n; ++i) {
+                    batch_b[(size_t)i * W + l] = b[(size_t)s * n + i];
+                    batch_x[(size_t)i * W + l] = x[(size_t)s * n + i];
+                }
+            }
+            batched_conjugate_gradient_interleaved<W>(batch_values.data(), col_indices, row_start, batch_b.data(), batch_x.data(),
+                                                      n, max_iterations, tolerance, lane_iterations, work.data());
+            for (int l = 0; l < W && batch * W + l < nsystems; ++l) {
+                const int s = batch * W + l;
+                for (int i = 0; i < n; ++i) x[(size_t)s * n + i] = batch_x[(size_t)i * W + l];
+                iterations[s] = lane_iterations[l];
+            }
+        }
+    }
+}
+
+// Merge-path SpMV (Merrill & Garland): the merge of the row ends with the nonzero indices is a
+// path of n + nnz steps, and every thread takes an equal share of it regardless of how the
+// nonzeros are distributed over rows. A thread that stops mid-row leaves a carry-out that is
+// added to that row after all threads finish. Diagonals run up to n + nnz, which can overflow
+// int even when n and nnz do not, so they are 64-bit.
+void merge_path_search(int64_t diagonal, const int* row_end, int n, int nnz, int& row, int& nz) {
+    int64_t lo = std::max(diagonal - nnz, (int64_t)0);
+    int64_t hi = std::min(diagonal, (int64_t)n);
+    while (lo < hi) {
+        int64_t pivot = (lo + hi) / 2;
+        if (row_end[pivot] <= diagonal - pivot - 1) {
+            lo = pivot + 1;
+        } else {
+            hi = pivot;
+        }
+    }
+    row = (int)lo;
+    nz = (int)(diagonal - lo);
+}
+
+void matrix_vector_multiply_merge_path(const double* values, const int* col_indices, const int* row_start, const double* x, double* result, int n) {
+    const int nnz = row_start[n];
+    const int* row_end = row_start + 1;
+    const int nthreads = omp_get_max_threads();
+    std::vector<int> carry_row(nthreads);
+    std::vector<double> carry_value(nthreads);
+    #pragma omp parallel for schedule(static, 1) num_threads(nthreads)
+    for (int t = 0; t < nthreads; ++t) {
+        const int64_t path_length = (int64_t)n + nnz;
+        const int64_t diagonal_start = path_length * t / nthreads;
+        const int64_t diagonal_end = path_length * (t + 1) / nthreads;
+        int row, nz, row_stop, nz_stop;
+        merge_path_search(diagonal_start, row_end, n, nnz, row, nz);
+        merge_path_search(diagonal_end, row_end, n, nnz, row_stop, nz_stop);
+        for (; row < row_stop; ++row) {
+            double sum = 0.0;
+            for (; nz < row_end[row]; ++nz) {
+                sum += values[nz] * x[col_indices[nz]];
+            }
+            result[row] = sum;
+        }
+        double sum = 0.0;
+        for (; nz < nz_stop; ++nz) {
+            sum += values[nz] * x[col_indices[nz]];
+        }
+        carry_row[t] = row_stop;
+        carry_value[t] = sum;
+    }
+    for (int t = 0; t < nthreads - 1; ++t) {
+        if (carry_row[t] < n) result[carry_row[t]] += carry_value[t];
+    }
+}
+
+struct MergePathOperator : LinearOperator {
+    const double* values;
+    const int* col_indices;
+    const int* row_start;
+
+    MergePathOperator(const double* values, const int* col_indices, const int* row_start)
+        : values(values), col_indices(col_indices), row_start(row_start) {}
+
+    void apply(const double* x, double* y, int n) override {
+        matrix_vector_multiply_merge_path(values, col_indices, row_start, x, y, n);
+    }
+};
+
+// Random symmetric matrix with power-law row lengths: row i gets about max_row_length/(i+1)^skew
+// random off-diagonal couplings (mirrored for symmetry) and a dominant diagonal, so it is SPD.
+void build_power_law_csr(int n, int max_row_length, double skew, unsigned seed,
+                         std::vector<double>& values, std::vector<int>& col_indices, std::vector<int>& row_start) {
+    std::vector<std::vector<std::pair<int, double>>> rows(n);
+    unsigned state = seed;
+    auto next = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    };
+    for (int i = 0; i < n; ++i) {
+        int length = std::max(1, (int)(max_row_length / pow(i + 1.0, skew)));
+        for (int k = 0; k < length; ++k) {
+            int j = next() % n;
+            if (j == i) continue;
+            double a = (next() & 1 ? -1.0 : 0.5) * (1.0 + (next() % 100) / 100.0);
+            rows[i].push_back({j, a});
+            rows[j].push_back({i, a});
+        }
+    }
+    values.clear();
+    col_indices.clear();
+    row_start.assign(n + 1, 0);
+    for (int i = 0; i < n; ++i) {
+        std::sort(rows[i].begin(), rows[i].end());
+        double off_sum = 0.0;
+        for (auto& entry : rows[i]) off_sum += fabs(entry.second);
+        values.push_back(off_sum + 1.0);
+        col_indices.push_back(i);
+        for (auto& entry : rows[i]) {
+            values.push_back(entry.second);
+            col_indices.push_back(entry.first);
+        }
+        row_start[i + 1] = values.size();
+    }
+}
+
+// ------------------------------------------------------------
+// SpMV autotuner: benchmarks the available formats, thread counts and OpenMP schedules on the
+// actual matrix and caches the winner on disk, keyed by a fingerprint of the matrix and the
+// CPU model, so later runs on the same matrix and machine skip the tuning.
+// ------------------------------------------------------------
+
+// Row-parallel CSR SpMV whose schedule is chosen at run time (omp_set_schedule)
+void matrix_vector_multiply_csr_omp(const double* values, const int* col_indices, const int* row_start, const double* x, double* result, int n) {
+    #pragma omp parallel for schedule(runtime)
+    for (int i = 0; i < n; ++i) {
+        double sum = 0.0;
+        for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+            sum += values[j] * x[col_indices[j]];
+        }
+        result[i] = sum;
+    }
+}
 
-    // Initial step: compute r = b - A*x
-    matrix_vector_multiply_csr(values, col_indices, row_start, x, Ax, n);
-    for (int i = 0; i < n; ++i) {
-        r[i] = b[i] - Ax[i];
-        p[i] = r[i];
+enum class SpMVFormat { csr, csr_omp, dict, binned, dia, merge_path };
+
+const char* spmv_format_name(SpMVFormat format) {
+    switch (format) {
+    case SpMVFormat::csr: return "csr";
+    case SpMVFormat::csr_omp: return "csr-omp";
+    case SpMVFormat::dict: return "dict-csr";
+    case SpMVFormat::binned: return "binned-csr";
+    case SpMVFormat::dia: return "dia";
+    case SpMVFormat::merge_path: return "merge-path";
     }
+    return "?";
+}
 
-    double rsold = 0.0;
+struct SpMVTuning {
+    SpMVFormat format = SpMVFormat::csr;
+    int threads = 1;
+    int schedule = omp_sched_static;   // omp_sched_t, only used by csr-omp
+    int chunk = 0;
+    double milliseconds = 0.0;
+};
+
+// FNV-1a over the matrix dimensions, structure and values
+uint64_t matrix_fingerprint(const double* values, const int* col_indices, const int* row_start, int n) {
+    const int nnz = row_start[n];
+    uint64_t hash = fnv1a(FNV_OFFSET_BASIS, &n, sizeof(n));
+    hash = fnv1a(hash, row_start, sizeof(int) * (n + 1));
+    hash = fnv1a(hash, col_indices, sizeof(int) * nnz);
+    return fnv1a(hash, values, sizeof(double) * nnz);
+}
+
+std::string cpu_model() {
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            std::string model = line.substr(line.find(':') + 2);
+            std::replace(model.begin(), model.end(), '|', '/');
+            return model + " x" + std::to_string(omp_get_num_procs());
+        }
+    }
+    return "unknown x" + std::to_string(omp_get_num_procs());
+}
+
+struct AutotunedOperator : LinearOperator {
+    const double* values;
+    const int* col_indices;
+    const int* row_start;
+    int n;
+    SpMVTuning tuning;
+    bool from_cache = false;
+    DIAMatrix dia;
+    DictCSRMatrix dict;
+    std::unique_ptr<BinnedCSRMatrix> binned;
+
+    // Cache file lines: fingerprint|cpu model|format|threads|schedule|chunk|milliseconds, and for
+    // binned-csr the tuned prefetch distances per row length: |d0,d1,...
+    AutotunedOperator(const double* values, const int* col_indices, const int* row_start, int n,
+                      const std::string& cache_path = "spmv_tuning.cache", int repetitions = 10)
+        : values(values), col_indices(col_indices), row_start(row_start), n(n) {
+        std::ostringstream key;
+        key << std::hex << matrix_fingerprint(values, col_indices, row_start, n) << std::dec << "|" << cpu_model();
+        std::ifstream cache(cache_path);
+        std::string line;
+        while (std::getline(cache, line)) {
+            if (line.compare(0, key.str().size() + 1, key.str() + "|") != 0) continue;
+            std::istringstream fields(line.substr(key.str().size() + 1));
+            std::string format;
+            char bar;
+            std::getline(fields, format, '|');
+            fields >> tuning.threads >> bar >> tuning.schedule >> bar >> tuning.chunk >> bar >> tuning.milliseconds;
+            for (SpMVFormat f : {SpMVFormat::csr, SpMVFormat::csr_omp, SpMVFormat::dict, SpMVFormat::binned,
+                                 SpMVFormat::dia, SpMVFormat::merge_path}) {
+                if (format == spmv_format_name(f)) {
+                    tuning.format = f;
+                    from_cache = prepare(f);
+                    break;
+                }
+            }
+            if (from_cache && tuning.format == SpMVFormat::binned) {
+                // Entries without the prefetch distances predate them; tune again
+                from_cache = fields.get() == '|';
+                for (int L = 0; from_cache && L <= MAX_FIXED_ROW_LENGTH; ++L) {
+                    from_cache = (L == 0 || fields.get() == ',') && (fields >> binned->prefetch_distance[L]);
+                }
+            }
+            if (from_cache) break;
+        }
+        if (from_cache) return;
+
+        tune(repetitions);
+        std::ofstream out(cache_path, std::ios::app);
+        out << key.str() << "|" << spmv_format_name(tuning.format) << "|" << tuning.threads << "|" << tuning.schedule
+            << "|" << tuning.chunk << "|" << tuning.milliseconds;
+        if (tuning.format == SpMVFormat::binned) {
+            for (int L = 0; L <= MAX_FIXED_ROW_LENGTH; ++L) {
+                out << (L == 0 ? "|" : ",") << binned->prefetch_distance[L];
+            }
+        }
+        out << "\n";
+    }
+
+    // Builds the data structures a format needs; false if the matrix does not suit it
+    bool prepare(SpMVFormat format) {
+        switch (format) {
+        case SpMVFormat::dia:
+            return !dia.offsets.empty() || csr_to_dia(values, col_indices, row_start, n, dia);
+        case SpMVFormat::dict:
+            return !dict.dictionary.empty() || csr_to_dict(values, col_indices, row_start, n, dict);
+        case SpMVFormat::binned:
+            if (!binned) binned.reset(new BinnedCSRMatrix(values, col_indices, row_start, n));
+            return true;
+        default:
+            return true;
+        }
+    }
+
+    // Runs one configuration; the thread count and runtime schedule it sets are process-wide,
+    // so both are restored afterwards
+    void run(const SpMVTuning& t, const double* x, double* y) {
+        const int saved_threads = omp_get_max_threads();
+        omp_sched_t saved_schedule;
+        int saved_chunk;
+        omp_get_schedule(&saved_schedule, &saved_chunk);
+        omp_set_num_threads(t.threads);
+        switch (t.format) {
+        case SpMVFormat::csr:
+            matrix_vector_multiply_csr(values, col_indices, row_start, x, y, n);
+            break;
+        case SpMVFormat::csr_omp:
+            omp_set_schedule((omp_sched_t)t.schedule, t.chunk);
+            matrix_vector_multiply_csr_omp(values, col_indices, row_start, x, y, n);
+            break;
+        case SpMVFormat::dict:
+            matrix_vector_multiply_dict_csr(dict, x, y, n);
+            break;
+        case SpMVFormat::binned:
+            binned->multiply(x, y);
+            break;
+        case SpMVFormat::dia:
+            matrix_vector_multiply_dia(dia, x, y);
+            break;
+        case SpMVFormat::merge_path:
+            matrix_vector_multiply_merge_path(values, col_indices, row_start, x, y, n);
+            break;
+        }
+        omp_set_num_threads(saved_threads);
+        omp_set_schedule(saved_schedule, saved_chunk);
+    }
+
+    void tune(int repetitions) {
+        std::vector<int> thread_counts;
+        for (int t = 1; t < omp_get_num_procs(); t *= 2) thread_counts.push_back(t);
+        thread_counts.push_back(omp_get_num_procs());
+        std::vector<SpMVTuning> candidates;
+        SpMVTuning serial;
+        candidates.push_back(serial);
+        for (int threads : thread_counts) {
+            for (auto schedule : {std::make_pair(omp_sched_static, 0), std::make_pair(omp_sched_dynamic, 256),
+                                  std::make_pair(omp_sched_guided, 64)}) {
+                SpMVTuning c;
+                c.format = SpMVFormat::csr_omp;
+                c.threads = threads;
+                c.schedule = schedule.first;
+                c.chunk = schedule.second;
+                candidates.push_back(c);
+            }
+            for (SpMVFormat format : {SpMVFormat::dict, SpMVFormat::binned, SpMVFormat::dia, SpMVFormat::merge_path}) {
+                if (!prepare(format)) continue;
+                SpMVTuning c;
+                c.format = format;
+                c.threads = threads;
+                candidates.push_back(c);
+            }
+        }
+        std::vector<double> x(n, 1.0), y(n);
+        tuning.milliseconds = 1e30;
+        // The best prefetch distances depend on the thread count, so binned-csr is tuned for
+        // each candidate's count and the distances of the winner are kept
+        std::array<int, MAX_FIXED_ROW_LENGTH + 1> best_prefetch_distance;
+        for (SpMVTuning& c : candidates) {
+            if (c.format == SpMVFormat::binned) {
+                const int saved_threads = omp_get_max_threads();
+                omp_set_num_threads(c.threads);
+                binned->tune_prefetch(x.data(), y.data(), 2);
+                omp_set_num_threads(saved_threads);
+            }
+            run(c, x.data(), y.data());   // warm-up
+            auto t1 = std::chrono::high_resolution_clock::now();
+            for (int rep = 0; rep < repetitions; ++rep) {
+                run(c, x.data(), y.data());
+            }
+            auto t2 = std::chrono::high_resolution_clock::now();
+            c.milliseconds = std::chrono::duration<double, std::milli>(t2 - t1).count() / repetitions;
+            std::cout << "  " << spmv_format_name(c.format) << ", " << c.threads << " threads"
+                      << (c.format == SpMVFormat::csr_omp ? ", schedule " + std::to_string(c.schedule) + "," + std::to_string(c.chunk) : "")
+                      << ": " << c.milliseconds << "ms" << std::endl;
+            if (c.milliseconds < tuning.milliseconds) {
+                tuning = c;
+                if (c.format == SpMVFormat::binned) {
+                    std::copy(binned->prefetch_distance, binned->prefetch_distance + MAX_FIXED_ROW_LENGTH + 1,
+                              best_prefetch_distance.begin());
+                }
+            }
+        }
+        if (tuning.format == SpMVFormat::binned) {
+            std::copy(best_prefetch_distance.begin(), best_prefetch_distance.end(), binned->prefetch_distance);
+        }
+        // Release the formats that lost
+        if (tuning.format != SpMVFormat::dia) dia = DIAMatrix();
+        if (tuning.format != SpMVFormat::dict) dict = DictCSRMatrix();
+        if (tuning.format != SpMVFormat::binned) binned.reset();
+    }
+
+    void apply(const double* x, double* y, int /*n*/) override {
+        run(tuning, x, y);
+    }
+};
+
+// ------------------------------------------------------------
+// Benchmark suite: parametric matrix generators and a driver that runs SpMV and CG on each
+// matrix over several sizes and writes a JSON report for regression tracking.
+// ------------------------------------------------------------
+
+struct CSRMatrix {
+    int n = 0;
+    std::vector<double> values;
+    std::vector<int> col_indices;
+    std::vector<int> row_start;
+};
+
+struct StencilPoint {
+    int dx, dy, dz;
+    double coefficient;
+};
+
+// Constant-coefficient stencil on an nx x ny x nz grid with Dirichlet boundaries (neighbours
+// outside the grid are dropped), rows ordered x fastest
+CSRMatrix build_stencil_csr(int nx, int ny, int nz, const std::vector<StencilPoint>& stencil) {
+    CSRMatrix A;
+    A.n = nx * ny * nz;
+    A.row_start.assign(A.n + 1, 0);
+    for (int z = 0; z < nz; ++z) {
+        for (int y = 0; y < ny; ++y) {
+            for (int x = 0; x < nx; ++x) {
+                const int row = (z * ny + y) * nx + x;
+                for (const StencilPoint& s : stencil) {
+                    int xx = x + s.dx, yy = y + s.dy, zz = z + s.dz;
+                    if (xx < 0 || xx >= nx || yy < 0 || yy >= ny || zz < 0 || zz >= nz) continue;
+                    A.values.push_back(s.coefficient);
+                    A.col_indices.push_back((zz * ny + yy) * nx + xx);
+                }
+                A.row_start[row + 1] = A.values.size();
+            }
+        }
+    }
+    return A;
+}
+
+// 2D 5-point operator -d/dx(ax d/dx) - d/dy(ay d/dy); ax != ay gives an anisotropic problem
+CSRMatrix build_laplacian_2d_5pt(int N, double ax = 1.0, double ay = 1.0) {
+    return build_stencil_csr(N, N, 1, {{0, 0, 0, 2 * ax + 2 * ay}, {-1, 0, 0, -ax}, {1, 0, 0, -ax}, {0, -1, 0, -ay}, {0, 1, 0, -ay}});
+}
+
+// 2D 9-point Laplacian with equal weights on all eight neighbours: 8 / -1, i.e. the 9-point
+// approximation (8 u0 - sum of neighbours) / (3 h^2) scaled by 3 h^2. Not the 20/-4/-1
+// Mehrstellen stencil, but SPD with the same sparsity, which is what the benchmark measures.
+CSRMatrix build_laplacian_2d_9pt(int N) {
+    std::vector<StencilPoint> stencil;
+    for (int dy = -1; dy <= 1; ++dy)
+        for (int dx = -1; dx <= 1; ++dx)
+            stencil.push_back({dx, dy, 0, dx == 0 && dy == 0 ? 8.0 : -1.0});
+    return build_stencil_csr(N, N, 1, stencil);
+}
+
+CSRMatrix build_laplacian_3d_7pt(int N) {
+    return build_stencil_csr(N, N, N, {{0, 0, 0, 6.0}, {-1, 0, 0, -1.0}, {1, 0, 0, -1.0}, {0, -1, 0, -1.0},
+                                       {0, 1, 0, -1.0}, {0, 0, -1, -1.0}, {0, 0, 1, -1.0}});
+}
+
+CSRMatrix build_laplacian_3d_27pt(int N) {
+    std::vector<StencilPoint> stencil;
+    for (int dz = -1; dz <= 1; ++dz)
+        for (int dy = -1; dy <= 1; ++dy)
+            for (int dx = -1; dx <= 1; ++dx)
+                stencil.push_back({dx, dy, dz, dx == 0 && dy == 0 && dz == 0 ? 26.0 : -1.0});
+    return build_stencil_csr(N, N, N, stencil);
+}
+
+// 2D 5-point operator -div(k grad u) with a smoothly varying, strongly contrasting coefficient
+// k(x, y); the face coefficients are shared by both cells, so the matrix stays symmetric
+CSRMatrix build_variable_coefficient_2d(int N) {
+    auto k = [N](double x, double y) {
+        return 1.0 + 0.99 * sin(6.0 * M_PI * x / N) * sin(4.0 * M_PI * y / N);
+    };
+    CSRMatrix A;
+    A.n = N * N;
+    A.row_start.assign(A.n + 1, 0);
+    for (int y = 0; y < N; ++y) {
+        for (int x = 0; x < N; ++x) {
+            const int row = y * N + x;
+            const double faces[4] = {k(x - 0.5, y), k(x + 0.5, y), k(x, y - 0.5), k(x, y + 0.5)};
+            const int neighbours[4] = {x > 0 ? row - 1 : -1, x < N - 1 ? row + 1 : -1, y > 0 ? row - N : -1, y < N - 1 ? row + N : -1};
+            A.values.push_back(faces[0] + faces[1] + faces[2] + faces[3]);
+            A.col_indices.push_back(row);
+            for (int f = 0; f < 4; ++f) {
+                if (neighbours[f] < 0) continue;
+                A.values.push_back(-faces[f]);
+                A.col_indices.push_back(neighbours[f]);
+            }
+            A.row_start[row + 1] = A.values.size();
+        }
+    }
+    return A;
+}
+
+// Block-structured matrix: the 2D 5-point Laplacian Kronecker a dense SPD block of size bs,
+// as produced by bs coupled unknowns per grid node
+CSRMatrix build_block_laplacian_2d(int N, int bs) {
+    CSRMatrix L = build_laplacian_2d_5pt(N);
+    std::vector<double> B(bs * bs);
+    for (int i = 0; i < bs; ++i)
+        for (int j = 0; j < bs; ++j) B[i * bs + j] = i == j ? 2.0 : 0.5 / (1 + abs(i - j));
+    CSRMatrix A;
+    A.n = L.n * bs;
+    A.row_start.assign(A.n + 1, 0);
+    for (int node = 0; node < L.n; ++node) {
+        for (int i = 0; i < bs; ++i) {
+            for (int j = L.row_start[node]; j < L.row_start[node + 1]; ++j) {
+                for (int c = 0; c < bs; ++c) {
+                    A.values.push_back(L.values[j] * B[i * bs + c]);
+                    A.col_indices.push_back(L.col_indices[j] * bs + c);
+                }
+            }
+            A.row_start[node * bs + i + 1] = A.values.size();
+        }
+    }
+    return A;
+}
+
+CSRMatrix build_power_law_matrix(int n, double skew) {
+    CSRMatrix A;
+    A.n = n;
+    build_power_law_csr(n, std::max(8, n / 100), skew, 4242u, A.values, A.col_indices, A.row_start);
+    return A;
+}
+
+// Convection-diffusion -laplace(u) + w . grad(u) on an N x N grid (scaled by h^2), with
+// first-order upwinding of the convection term. `peclet` is the cell Peclet number |w| h; the
+// wind blows at 30 degrees to the x axis. Nonsymmetric for any peclet > 0.
+CSRMatrix build_convection_diffusion_2d(int N, double peclet) {
+    const double px = peclet * cos(M_PI / 6), py = peclet * sin(M_PI / 6);
+    return build_stencil_csr(N, N, 1, {{0, 0, 0, 4.0 + px + py}, {-1, 0, 0, -1.0 - px}, {1, 0, 0, -1.0},
+                                       {0, -1, 0, -1.0 - py}, {0, 1, 0, -1.0}});
+}
+
+// String contents for a JSON string literal
+std::string json_escape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char)c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+struct BenchmarkCase {
+    std::string name;
+    int size;
+    CSRMatrix matrix;
+};
+
+// Runs every generator at two sizes; for each matrix reports SpMV GB/s and GFLOP/s (serial CSR
+// kernel, minimum traffic model: values, column indices, row pointers, x and y once) and the
+// CG iterations (at most 2000) and time to a relative residual of 1e-8. Writes the JSON report
+// to `path`, with the thread counts of the SpMV (1) and of the CG vector operations.
+int run_benchmark_suite(const std::string& path) {
+    std::vector<BenchmarkCase> cases;
+    for (int N : {128, 512}) {
+        cases.push_back({"laplace2d_5pt", N, build_laplacian_2d_5pt(N)});
+        cases.push_back({"laplace2d_9pt", N, build_laplacian_2d_9pt(N)});
+        cases.push_back({"anisotropic2d_5pt", N, build_laplacian_2d_5pt(N, 1.0, 0.01)});
+        cases.push_back({"varcoef2d_5pt", N, build_variable_coefficient_2d(N)});
+        cases.push_back({"block2d_5pt_bs3", N / 2, build_block_laplacian_2d(N / 2, 3)});
+        cases.push_back({"powerlaw_skew0.5", N * N / 4, build_power_law_matrix(N * N / 4, 0.5)});
+        cases.push_back({"powerlaw_skew1.0", N * N / 4, build_power_law_matrix(N * N / 4, 1.0)});
+    }
+    for (int N : {24, 48}) {
+        cases.push_back({"laplace3d_7pt", N, build_laplacian_3d_7pt(N)});
+        cases.push_back({"laplace3d_27pt", N, build_laplacian_3d_27pt(N)});
+    }
+
+    std::ofstream report(path);
+    report << "{\n  \"spmv_threads\": 1,\n  \"cg_threads\": " << omp_get_max_threads()
+           << ",\n  \"cpu\": \"" << json_escape(cpu_model()) << "\",\n  \"results\": [\n";
+    for (size_t c = 0; c < cases.size(); ++c) {
+        const CSRMatrix& A = cases[c].matrix;
+        const int n = A.n;
+        const long long nnz = A.row_start[n];
+        std::vector<double> x(n, 1.0), y(n), b(n, 1.0), sol(n, 0.0);
+
+        const int repetitions = std::max(3, (int)(2e8 / (nnz + 1)));
+        matrix_vector_multiply_csr(A.values.data(), A.col_indices.data(), A.row_start.data(), x.data(), y.data(), n);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (int rep = 0; rep < repetitions; ++rep) {
+            matrix_vector_multiply_csr(A.values.data(), A.col_indices.data(), A.row_start.data(), x.data(), y.data(), n);
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+        const double spmv_s = std::chrono::duration<double>(t2 - t1).count() / repetitions;
+        const double bytes = 12.0 * nnz + 4.0 * (n + 1) + 16.0 * n;
+        const double gbs = bytes / spmv_s / 1e9;
+        const double gflops = 2.0 * nnz / spmv_s / 1e9;
+
+        auto t3 = std::chrono::high_resolution_clock::now();
+        int iterations = conjugate_gradient_csr(A.values.data(), A.col_indices.data(), A.row_start.data(), b.data(), sol.data(),
+                                                n, 2000, 1e-8 * sqrt((double)n), nullptr, nullptr, false);
+        auto t4 = std::chrono::high_resolution_clock::now();
+        const double cg_ms = std::chrono::duration<double, std::milli>(t4 - t3).count();
+
+        std::cout << cases[c].name << " size " << cases[c].size << ": n " << n << ", nnz " << nnz << ", SpMV " << gbs << " GB/s "
+                  << gflops << " GFLOP/s, CG " << iterations << " iterations " << cg_ms << "ms" << std::endl;
+        report << "    {\"matrix\": \"" << json_escape(cases[c].name) << "\", \"size\": " << cases[c].size << ", \"n\": " << n
+               << ", \"nnz\": " << nnz << ", \"spmv_ms\": " << spmv_s * 1e3 << ", \"spmv_gbs\": " << gbs
+               << ", \"spmv_gflops\": " << gflops << ", \"cg_iterations\": " << iterations << ", \"cg_ms\": " << cg_ms << "}"
+               << (c + 1 < cases.size() ? "," : "") << "\n";
+    }
+    report << "  ]\n}\n";
+    std::cout << "Report written to " << path << std::endl;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Sparse matrix-matrix multiply C = A * B on CSR, two phases: a symbolic pass counts the
+// distinct columns of every row of C so it can be allocated exactly, then a numeric pass
+// fills it. Both passes accumulate a row in a thread-private open-addressing hash table
+// sized to the row's upper bound, and rows are spread dynamically over threads.
+// ------------------------------------------------------------
+
+// Hash accumulator for one row of C; capacity is a power of two at least twice the bound
+struct RowHashAccumulator {
+    std::vector<int> keys;
+    std::vector<double> sums;
+    std::vector<int> used;   // slots in insertion order, for cheap reset and extraction
+
+    void reset(int bound) {
+        int capacity = 16;
+        while (capacity < 2 * bound) capacity *= 2;
+        if ((int)keys.size() < capacity) {
+            keys.assign(capacity, -1);
+            sums.assign(capacity, 0.0);
+        }
+        for (int slot : used) keys[slot] = -1;
+        used.clear();
+    }
+
+    void add(int key, double value, int mask) {
+        int slot = (int)(((unsigned)key * 107u) & (unsigned)mask);
+        while (keys[slot] != -1 && keys[slot] != key) slot = (slot + 1) & mask;
+        if (keys[slot] == -1) {
+            keys[slot] = key;
+            sums[slot] = 0.0;
+            used.push_back(slot);
+        }
+        sums[slot] += value;
+    }
+};
+
+CSRMatrix spgemm_csr(const double* a_values, const int* a_cols, const int* a_rows, int a_n,
+                     const double* b_values, const int* b_cols, const int* b_rows) {
+    CSRMatrix C;
+    C.n = a_n;
+    C.row_start.assign(a_n + 1, 0);
+    // Upper bound on the row lengths of C: sum of the lengths of the B rows it touches
+    std::vector<int> bound(a_n);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < a_n; ++i) {
+        int sum = 0;
+        for (int j = a_rows[i]; j < a_rows[i + 1]; ++j) sum += b_rows[a_cols[j] + 1] - b_rows[a_cols[j]];
+        bound[i] = sum;
+    }
+
+    #pragma omp parallel
+    {
+        RowHashAccumulator acc;
+        #pragma omp for schedule(dynamic, 256)
+        for (int i = 0; i < a_n; ++i) {
+            acc.reset(bound[i]);
+            const int mask = acc.keys.size() - 1;
+            for (int j = a_rows[i]; j < a_rows[i + 1]; ++j) {
+                const int k = a_cols[j];
+                for (int jb = b_rows[k]; jb < b_rows[k + 1]; ++jb) acc.add(b_cols[jb], 0.0, mask);
+            }
+            C.row_start[i + 1] = acc.used.size();
+        }
+    }
+    for (int i = 0; i < a_n; ++i) C.row_start[i + 1] += C.row_start[i];
+    C.values.resize(C.row_start[a_n]);
+    C.col_indices.resize(C.row_start[a_n]);
+
+    #pragma omp parallel
+    {
+        RowHashAccumulator acc;
+        #pragma omp for schedule(dynamic, 256)
+        for (int i = 0; i < a_n; ++i) {
+            acc.reset(bound[i]);
+            const int mask = acc.keys.size() - 1;
+            for (int j = a_rows[i]; j < a_rows[i + 1]; ++j) {
+                const int k = a_cols[j];
+                const double a = a_values[j];
+                for (int jb = b_rows[k]; jb < b_rows[k + 1]; ++jb) acc.add(b_cols[jb], a * b_values[jb], mask);
+            }
+            int* cols = &C.col_indices[C.row_start[i]];
+            double* vals = &C.values[C.row_start[i]];
+            if (acc.used.size() > 64) {
+                std::sort(acc.used.begin(), acc.used.end(), [&acc](int a, int b) { return acc.keys[a] < acc.keys[b]; });
+                for (size_t k = 0; k < acc.used.size(); ++k) {
+                    cols[k] = acc.keys[acc.used[k]];
+                    vals[k] = acc.sums[acc.used[k]];
+                }
+                continue;
+            }
+            // Short rows: insertion sort by column straight into the output
+            int length = 0;
+            for (int slot : acc.used) {
+                int k = length++;
+                while (k > 0 && cols[k - 1] > acc.keys[slot]) {
+                    cols[k] = cols[k - 1];
+                    vals[k] = vals[k - 1];
+                    --k;
+                }
+                cols[k] = acc.keys[slot];
+                vals[k] = acc.sums[slot];
+            }
+        }
+    }
+    return C;
+}
+
+CSRMatrix spgemm_csr(const CSRMatrix& A, const CSRMatrix& B) {
+    return spgemm_csr(A.values.data(), A.col_indices.data(), A.row_start.data(), A.n,
+                      B.values.data(), B.col_indices.data(), B.row_start.data());
+}
+
+// Transpose of an n x m CSR matrix
+CSRMatrix transpose_csr(const CSRMatrix& A, int m) {
+    CSRMatrix T;
+    T.n = m;
+    T.row_start.assign(m + 1, 0);
+    const int nnz = A.row_start[A.n];
+    for (int j = 0; j < nnz; ++j) T.row_start[A.col_indices[j] + 1]++;
+    for (int i = 0; i < m; ++i) T.row_start[i + 1] += T.row_start[i];
+    T.values.resize(nnz);
+    T.col_indices.resize(nnz);
+    std::vector<int> fill(T.row_start.begin(), T.row_start.end() - 1);
+    for (int i = 0; i < A.n; ++i) {
+        for (int j = A.row_start[i]; j < A.row_start[i + 1]; ++j) {
+            const int k = fill[A.col_indices[j]]++;
+            T.col_indices[k] = i;
+            T.values[k] = A.values[j];
+        }
+    }
+    return T;
+}
+
+// Multiply-add count of A * B
+long long spgemm_flops(const CSRMatrix& A, const CSRMatrix& B) {
+    long long flops = 0;
+    for (int j = 0; j < A.row_start[A.n]; ++j) flops += B.row_start[A.col_indices[j] + 1] - B.row_start[A.col_indices[j]];
+    return flops;
+}
+
+// ------------------------------------------------------------
+// Small dense helpers (row-major m x m) for the subspace computations
+// ------------------------------------------------------------
+
+// In-place Cholesky A = L L^T (lower triangle); returns false if A is not positive definite
+bool dense_cholesky(std::vector<double>& a, int m) {
+    for (int j = 0; j < m; ++j) {
+        double d = a[j * m + j];
+        for (int k = 0; k < j; ++k) d -= a[j * m + k] * a[j * m + k];
+        if (d <= 0.0) return false;
+        a[j * m + j] = sqrt(d);
+        for (int i = j + 1; i < m; ++i) {
+            double sum = a[i * m + j];
+            for (int k = 0; k < j; ++k) sum -= a[i * m + k] * a[j * m + k];
+            a[i * m + j] = sum / a[j * m + j];
+        }
+    }
+    return true;
+}
+
+// Solves L L^T y = rhs in place using the factor from dense_cholesky
+void dense_cholesky_solve(const std::vector<double>& l, int m, double* y) {
+    for (int i = 0; i < m; ++i) {
+        for (int k = 0; k < i; ++k) y[i] -= l[i * m + k] * y[k];
+        y[i] /= l[i * m + i];
+    }
+    for (int i = m - 1; i >= 0; --i) {
+        for (int k = i + 1; k < m; ++k) y[i] -= l[k * m + i] * y[k];
+        y[i] /= l[i * m + i];
+    }
+}
+
+// Cyclic Jacobi eigensolver for a symmetric matrix; eigenvector c is column c of `vectors`
+void dense_symmetric_eigen(std::vector<double> a, int m, std::vector<double>& eigenvalues, std::vector<double>& vectors) {
+    vectors.assign(m * m, 0.0);
+    for (int i = 0; i < m; ++i) vectors[i * m + i] = 1.0;
+    for (int sweep = 0; sweep < 100; ++sweep) {
+        double off = 0.0;
+        for (int p = 0; p < m; ++p)
+            for (int q = p + 1; q < m; ++q) off += a[p * m + q] * a[p * m + q];
+        if (off < 1e-30) break;
+        for (int p = 0; p < m; ++p) {
+            for (int q = p + 1; q < m; ++q) {
+                if (fabs(a[p * m + q]) < 1e-300) continue;
+                double theta = 0.5 * (a[q * m + q] - a[p * m + p]) / a[p * m + q];
+                double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+                for (int k = 0; k < m; ++k) {
+                    double akp = a[k * m + p], akq = a[k * m + q];
+                    a[k * m + p] = c * akp - s * akq;
+                    a[k * m + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < m; ++k) {
+                    double apk = a[p * m + k], aqk = a[q * m + k];
+                    a[p * m + k] = c * apk - s * aqk;
+                    a[q * m + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < m; ++k) {
+                    double vkp = vectors[k * m + p], vkq = vectors[k * m + q];
+                    vectors[k * m + p] = c * vkp - s * vkq;
+                    vectors[k * m + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    eigenvalues.resize(m);
+    for (int i = 0; i < m; ++i) eigenvalues[i] = a[i * m + i];
+}
+
+double dot_product(const double* a, const double* b, int n) {
+    double sum = 0.0;
+    #pragma omp parallel for reduction(+:sum)
     for (int i = 0; i < n; ++i) {
-        rsold += r[i] * r[i];
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Deflated CG (Saad, Yeung, Erhel & Guyomarc'h) for sequences of related systems. The search
+// directions are kept A-orthogonal to a subspace W of approximate low eigenvectors, so the
+// slow modes no longer limit convergence.
+//
+// W is harvested from the solves themselves with the eigCG scheme (Stathopoulos & Orginos):
+// the CG residuals are the Lanczos vectors and alpha/beta give the Lanczos matrix T, so a
+// window of `window` Lanczos vectors is kept and, whenever it is full, compressed to the Ritz
+// vectors of the nev smallest eigenvalues of T and of its leading (m-1) block. At the end of
+// a solve the nev smallest Ritz vectors are appended to W until it reaches subspace_size.
+// Because later solves are already deflated, their Ritz vectors approximate the next modes.
+struct DeflatedCG {
+    LinearOperator& A;
+    int n, subspace_size, window;
+    int k = 0;                          // current number of deflation vectors
+    std::vector<double> W, AW;          // column c at [c*n, (c+1)*n)
+    std::vector<double> WtAW;           // Cholesky factor of W^T A W
+
+    // eigCG state for the current solve
+    int nev = 0, mv = 0;
+    std::vector<double> V, T;           // Lanczos window (columns) and its projected matrix (window x window)
+    std::vector<double> coupling;       // after a restart: T(0..2nev-1, next vector) / t
+
+    DeflatedCG(LinearOperator& A, int n, int subspace_size, int window)
+        : A(A), n(n), subspace_size(subspace_size), window(window) {}
+
+    // mu = (W^T A W)^-1 (AW)^T v
+    void project(const double* v, std::vector<double>& mu) {
+        mu.resize(k);
+        for (int c = 0; c < k; ++c) mu[c] = dot_product(&AW[(size_t)c * n], v, n);
+        dense_cholesky_solve(WtAW, k, mu.data());
     }
 
-    for (int i = 0; i < max_iterations; ++i) {
-        matrix_vector_multiply_csr(values, col_indices, row_start, p, Ap, n);
-        double pAp = 0.0;
-        for (int j = 0; j < n; ++j) {
-            pAp += p[j] * Ap[j];
+    // Eigenpairs of the leading m x m block of T, sorted by increasing eigenvalue
+    void window_eigen(int m, std::vector<double>& values, std::vector<double>& vectors) {
+        std::vector<double> Tm(m * m);
+        for (int i = 0; i < m; ++i)
+            for (int j = 0; j < m; ++j) Tm[i * m + j] = T[i * window + j];
+        std::vector<double> unsorted_values, unsorted_vectors;
+        dense_symmetric_eigen(Tm, m, unsorted_values, unsorted_vectors);
+        std::vector<int> order(m);
+        for (int i = 0; i < m; ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](int a, int c) { return unsorted_values[a] < unsorted_values[c]; });
+        values.resize(m);
+        vectors.resize(m * m);
+        for (int c = 0; c < m; ++c) {
+            values[c] = unsorted_values[order[c]];
+            for (int i = 0; i < m; ++i) vectors[i * m + c] = unsorted_vectors[i * m + order[c]];
+        }
+    }
+
+    // V <- V * Y for an mv x cols coefficient matrix Y (row-major)
+    void rotate_window(const std::vector<double>& Y, int cols) {
+        std::vector<double> rotated((size_t)cols * n, 0.0);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; ++i) {
+            for (int c = 0; c < cols; ++c) {
+                double sum = 0.0;
+                for (int j = 0; j < mv; ++j) sum += V[(size_t)j * n + i] * Y[j * cols + c];
+                rotated[(size_t)c * n + i] = sum;
+            }
+        }
+        std::copy(rotated.begin(), rotated.end(), V.begin());
+    }
+
+    // Full window: keep span{Ritz vectors of T_m, Ritz vectors of T_(m-1)} as 2*nev vectors
+    void restart_window() {
+        std::vector<double> values, Y, values1, Y1;
+        window_eigen(mv, values, Y);
+        window_eigen(mv - 1, values1, Y1);
+        const int keep = 2 * nev;
+        // Q = orth([Y(:, 0:nev), [Y1(:, 0:nev); 0]]) by modified Gram-Schmidt on mv-vectors
+        std::vector<double> Q(mv * keep, 0.0);
+        int q = 0;
+        for (int c = 0; c < keep; ++c) {
+            std::vector<double> u(mv, 0.0);
+            for (int i = 0; i < mv; ++i) u[i] = c < nev ? Y[i * mv + c] : (i < mv - 1 ? Y1[i * (mv - 1) + c - nev] : 0.0);
+            for (int pass = 0; pass < 2; ++pass) {
+                for (int d = 0; d < q; ++d) {
+                    double h = 0.0;
+                    for (int i = 0; i < mv; ++i) h += Q[i * keep + d] * u[i];
+                    for (int i = 0; i < mv; ++i) u[i] -= h * Q[i * keep + d];
+                }
+            }
+            double norm = 0.0;
+            for (int i = 0; i < mv; ++i) norm += u[i] * u[i];
+            norm = sqrt(norm);
+            if (norm < 1e-10) continue;
+            for (int i = 0; i < mv; ++i) Q[i * keep + q] = u[i] / norm;
+            ++q;
+        }
+        // H = Q^T T Q, diagonalised so the kept vectors are Ritz vectors: V <- V Q Z, T <- diag
+        std::vector<double> TQ(mv * q, 0.0), H(q * q, 0.0);
+        for (int i = 0; i < mv; ++i)
+            for (int c = 0; c < q; ++c)
+                for (int j = 0; j < mv; ++j) TQ[i * q + c] += T[i * window + j] * Q[j * keep + c];
+        for (int a = 0; a < q; ++a)
+            for (int c = 0; c < q; ++c)
+                for (int i = 0; i < mv; ++i) H[a * q + c] += Q[i * keep + a] * TQ[i * q + c];
+        std::vector<double> M, Z;
+        dense_symmetric_eigen(H, q, M, Z);
+        std::vector<double> QZ(mv * q, 0.0);
+        for (int i = 0; i < mv; ++i)
+            for (int c = 0; c < q; ++c)
+                for (int j = 0; j < q; ++j) QZ[i * q + c] += Q[i * keep + j] * Z[j * q + c];
+        rotate_window(QZ, q);
+        // The next Lanczos vector coupled only to the last window vector, so its coupling to
+        // the kept vectors is the last row of QZ times that entry
+        coupling.assign(q, 0.0);
+        for (int c = 0; c < q; ++c) coupling[c] = QZ[(mv - 1) * q + c];
+        std::fill(T.begin(), T.end(), 0.0);
+        for (int c = 0; c < q; ++c) T[c * window + c] = M[c];
+        mv = q;
+    }
+
+    // Adds the Lanczos vector r/||r|| with T(j,j) = diag and T(j-1,j) = offdiag
+    void add_lanczos_vector(const double* r, double rnorm, double diag, double offdiag, bool first) {
+        if (mv == window) restart_window();
+        double* v = &V[(size_t)mv * n];
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) v[i] = r[i] / rnorm;
+        T[mv * window + mv] = diag;
+        if (!first) {
+            if (!coupling.empty()) {
+                for (size_t c = 0; c < coupling.size(); ++c) {
+                    T[c * window + mv] = T[mv * window + c] = coupling[c] * offdiag;
+                }
+                coupling.clear();
+            } else if (mv > 0) {
+                T[(mv - 1) * window + mv] = T[mv * window + (mv - 1)] = offdiag;
+            }
+        }
+        ++mv;
+    }
+
+    // Appends the nev smallest Ritz vectors of the window to W and refreshes AW and W^T A W
+    void append_ritz_vectors() {
+        const int add = std::min(nev, mv);
+        if (add <= 0) return;
+        std::vector<double> values, Y;
+        window_eigen(mv, values, Y);
+        std::vector<double> Yadd(mv * add);
+        for (int i = 0; i < mv; ++i)
+            for (int c = 0; c < add; ++c) Yadd[i * add + c] = Y[i * mv + c];
+        rotate_window(Yadd, add);
+        W.resize((size_t)(k + add) * n);
+        AW.resize((size_t)(k + add) * n);
+        for (int c = 0; c < add; ++c) {
+            std::copy(V.begin() + (size_t)c * n, V.begin() + (size_t)(c + 1) * n, W.begin() + (size_t)(k + c) * n);
+            A.apply(&W[(size_t)(k + c) * n], &AW[(size_t)(k + c) * n], n);
+        }
+        const int new_k = k + add;
+        std::vector<double> G(new_k * new_k);
+        for (int a = 0; a < new_k; ++a)
+            for (int c = a; c < new_k; ++c)
+                G[a * new_k + c] = G[c * new_k + a] = dot_product(&W[(size_t)a * n], &AW[(size_t)c * n], n);
+        if (dense_cholesky(G, new_k)) {
+            k = new_k;
+            WtAW = G;
+        } else {
+            W.resize((size_t)k * n);
+            AW.resize((size_t)k * n);
+        }
+    }
+
+    int solve(const double* b, double* x, int max_iterations, double tolerance) {
+        std::vector<double> r(n), p(n), Ap(n), mu;
+        // eigCG runs only while W still has room
+        nev = std::min(std::max(1, subspace_size / 2), subspace_size - k);
+        mv = 0;
+        coupling.clear();
+        if (nev > 0) {
+            window = std::max(window, 2 * nev + 2);
+            V.assign((size_t)window * n, 0.0);
+            T.assign(window * window, 0.0);
+        }
+
+        A.apply(x, Ap.data(), n);
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) r[i] = b[i] - Ap[i];
+        // Start from the solution component in span(W): x += W mu, r -= AW mu with mu = (W^T A W)^-1 W^T r
+        if (k > 0) {
+            mu.resize(k);
+            for (int c = 0; c < k; ++c) mu[c] = dot_product(&W[(size_t)c * n], r.data(), n);
+            dense_cholesky_solve(WtAW, k, mu.data());
+            for (int c = 0; c < k; ++c) {
+                #pragma omp parallel for
+                for (int i = 0; i < n; ++i) {
+                    x[i] += mu[c] * W[(size_t)c * n + i];
+                    r[i] -= mu[c] * AW[(size_t)c * n + i];
+                }
+            }
+        }
+        // p0 = r0 - W mu0
+        project(r.data(), mu);
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            double sum = r[i];
+            for (int c = 0; c < k; ++c) sum -= mu[c] * W[(size_t)c * n + i];
+            p[i] = sum;
+        }
+        double rsold = dot_product(r.data(), r.data(), n);
+
+        int iterations = max_iterations;
+        double alpha_old = 1.0, beta_old = 0.0;
+        for (int it = 0; it < max_iterations; ++it) {
+            A.apply(p.data(), Ap.data(), n);
+            double alpha = rsold / dot_product(p.data(), Ap.data(), n);
+            // Lanczos vector v_it = r_it/||r_it||: T(it,it) = 1/alpha_it + beta_(it-1)/alpha_(it-1),
+            // T(it-1,it) = -sqrt(beta_(it-1))/alpha_(it-1)
+            if (nev > 0) {
+                add_lanczos_vector(r.data(), sqrt(rsold), 1.0 / alpha + (it > 0 ? beta_old / alpha_old : 0.0),
+                                   -sqrt(beta_old) / alpha_old, it == 0);
+            }
+            #pragma omp parallel for
+            for (int i = 0; i < n; ++i) {
+                x[i] += alpha * p[i];
+                r[i] -= alpha * Ap[i];
+            }
+            double rsnew = dot_product(r.data(), r.data(), n);
+            if (sqrt(rsnew) < tolerance) {
+                iterations = it + 1;
+                break;
+            }
+            // p = r + beta p - W mu, with mu making p A-orthogonal to W
+            project(r.data(), mu);
+            const double beta = rsnew / rsold;
+            #pragma omp parallel for
+            for (int i = 0; i < n; ++i) {
+                double sum = r[i] + beta * p[i];
+                for (int c = 0; c < k; ++c) sum -= mu[c] * W[(size_t)c * n + i];
+                p[i] = sum;
+            }
+            alpha_old = alpha;
+            beta_old = beta;
+            rsold = rsnew;
+        }
+        if (nev > 0) {
+            append_ritz_vectors();
+            V.clear();
+            V.shrink_to_fit();
+        }
+        return iterations;
+    }
+};
+
+// Factorized sparse approximate inverse: M^-1 = G^T G with G lower triangular on the pattern
+// of the lower triangle of A^level. Row i of G comes from its own small dense SPD solve
+// A(P_i, P_i) g = e_i, scaled by 1/sqrt(g_i), so the setup is embarrassingly parallel, and
+// applying it is two CSR SpMVs (G and an explicit G^T) with no triangular solves.
+struct FSAIPreconditioner : Preconditioner {
+    CSRMatrix G, GT;
+    std::vector<double> t;
+
+    FSAIPreconditioner(const double* values, const int* col_indices, const int* row_start, int n, int level = 1) : t(n) {
+        // Column-sorted copy of A for binary-search lookups
+        std::vector<int> sorted_cols(col_indices, col_indices + row_start[n]);
+        std::vector<double> sorted_values(row_start[n]);
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            std::vector<std::pair<int, double>> row;
+            for (int j = row_start[i]; j < row_start[i + 1]; ++j) row.push_back({col_indices[j], values[j]});
+            std::sort(row.begin(), row.end());
+            for (size_t k = 0; k < row.size(); ++k) {
+                sorted_cols[row_start[i] + k] = row[k].first;
+                sorted_values[row_start[i] + k] = row[k].second;
+            }
+        }
+        auto entry = [&](int r, int c) {
+            const int* begin = &sorted_cols[row_start[r]];
+            const int* end = &sorted_cols[row_start[r + 1]];
+            const int* it = std::lower_bound(begin, end, c);
+            return it != end && *it == c ? sorted_values[it - &sorted_cols[0]] : 0.0;
+        };
+
+        // Row patterns: lower triangle of A^level, diagonal last
+        std::vector<std::vector<int>> patterns(n);
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (int i = 0; i < n; ++i) {
+            std::vector<int> pattern = {i};
+            for (int l = 0; l < level; ++l) {
+                std::vector<int> next = pattern;
+                for (int p : pattern) {
+                    for (int j = row_start[p]; j < row_start[p + 1]; ++j) next.push_back(sorted_cols[j]);
+                }
+                std::sort(next.begin(), next.end());
+                next.erase(std::unique(next.begin(), next.end()), next.end());
+                pattern.swap(next);
+            }
+            pattern.erase(std::upper_bound(pattern.begin(), pattern.end(), i), pattern.end());
+            patterns[i].swap(pattern);
+        }
+        G.n = n;
+        G.row_start.assign(n + 1, 0);
+        for (int i = 0; i < n; ++i) G.row_start[i + 1] = G.row_start[i] + patterns[i].size();
+        G.values.resize(G.row_start[n]);
+        G.col_indices.resize(G.row_start[n]);
+
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (int i = 0; i < n; ++i) {
+            const std::vector<int>& pattern = patterns[i];
+            const int m = pattern.size();
+            std::vector<double> local(m * m), g(m, 0.0);
+            for (int a = 0; a < m; ++a)
+                for (int c = 0; c < m; ++c) local[a * m + c] = entry(pattern[a], pattern[c]);
+            g[m - 1] = 1.0;
+            if (dense_cholesky(local, m)) {
+                dense_cholesky_solve(local, m, g.data());
+            } else {
+                // Not SPD locally (should not happen for SPD A): fall back to Jacobi for this row
+                std::fill(g.begin(), g.end(), 0.0);
+                g[m - 1] = 1.0 / entry(i, i);
+            }
+            const double scale = 1.0 / sqrt(g[m - 1]);
+            for (int a = 0; a < m; ++a) {
+                G.col_indices[G.row_start[i] + a] = pattern[a];
+                G.values[G.row_start[i] + a] = g[a] * scale;
+            }
+        }
+
+        // Explicit transpose so G^T r is also a row-parallel SpMV
+        GT.n = n;
+        GT.row_start.assign(n + 1, 0);
+        for (int j = 0; j < G.row_start[n]; ++j) GT.row_start[G.col_indices[j] + 1]++;
+        for (int i = 0; i < n; ++i) GT.row_start[i + 1] += GT.row_start[i];
+        GT.values.resize(G.row_start[n]);
+        GT.col_indices.resize(G.row_start[n]);
+        std::vector<int> fill(GT.row_start.begin(), GT.row_start.end() - 1);
+        for (int i = 0; i < n; ++i) {
+            for (int j = G.row_start[i]; j < G.row_start[i + 1]; ++j) {
+                const int k = fill[G.col_indices[j]]++;
+                GT.col_indices[k] = i;
+                GT.values[k] = G.values[j];
+            }
+        }
+    }
+
+    void apply(const double* r, double* z, int n) override {
+        matrix_vector_multiply_merge_path(G.values.data(), G.col_indices.data(), G.row_start.data(), r, t.data(), n);
+        matrix_vector_multiply_merge_path(GT.values.data(), GT.col_indices.data(), GT.row_start.data(), t.data(), z, n);
+    }
+};
+
+// ------------------------------------------------------------
+// Supernodal sparse Cholesky for SPD systems solved against many right-hand sides:
+// nested-dissection ordering, elimination tree and symbolic factorisation, then a
+// multifrontal numeric factorisation with blocked dense kernels on every supernode, run in
+// parallel over independent subtrees of the supernodal elimination tree.
+// ------------------------------------------------------------
+
+// Nested dissection by recursive level-structure bisection: BFS from a pseudo-peripheral
+// vertex, the middle level becomes the separator and is numbered after both halves.
+// perm[k] = original index of the k-th unknown in the new order.
+void nested_dissection_order(const int* col_indices, const int* row_start, int n, std::vector<int>& perm, int leaf_size = 64) {
+    std::vector<int> label(n, 0), level(n, -1);
+    int next_label = 1;
+
+    // BFS over the vertices carrying `tag`; returns them in BFS order and fills level[]
+    auto bfs = [&](int start, int tag, std::vector<int>& order) {
+        order.clear();
+        order.push_back(start);
+        level[start] = 0;
+        for (size_t head = 0; head < order.size(); ++head) {
+            const int v = order[head];
+            for (int j = row_start[v]; j < row_start[v + 1]; ++j) {
+                const int w = col_indices[j];
+                if (label[w] == tag && level[w] < 0) {
+                    level[w] = level[v] + 1;
+                    order.push_back(w);
+                }
+            }
+        }
+    };
+
+    // Work list of (vertices, tag, first position of their range); the separator of a range
+    // takes its last positions, so the halves can be processed in any order
+    struct Part {
+        std::vector<int> vertices;
+        int tag, offset;
+    };
+    std::vector<Part> work;
+    std::vector<int> all(n);
+    for (int i = 0; i < n; ++i) all[i] = i;
+    perm.assign(n, -1);
+    work.push_back({std::move(all), 0, 0});
+    std::vector<int> order;
+    while (!work.empty()) {
+        Part part = std::move(work.back());
+        work.pop_back();
+        std::vector<int>& vertices = part.vertices;
+        if ((int)vertices.size() <= leaf_size) {
+            std::copy(vertices.begin(), vertices.end(), perm.begin() + part.offset);
+            continue;
         }
-        double alpha = rsold / pAp;
+        // Pseudo-peripheral start: restart from the last vertex of the BFS a few times
+        int start = vertices[0];
+        for (int sweep = 0; sweep < 3; ++sweep) {
+            bfs(start, part.tag, order);
+            const int far = order.back();
+            for (int v : order) level[v] = -1;
+            if (far == start) break;
+            start = far;
+        }
+        bfs(start, part.tag, order);
+        const int depth = level[order.back()];
+        // Middle level by vertex count
+        int separator_level = level[order[order.size() / 2]];
+        if (separator_level == 0 && depth > 0) separator_level = 1;
+        std::vector<int> first, second, separator;
+        for (int v : order) {
+            if (level[v] < separator_level) first.push_back(v);
+            else if (level[v] == separator_level) separator.push_back(v);
+            else second.push_back(v);
+        }
+        // Vertices in other components of this subgraph go with the second half
+        for (int v : vertices) {
+            if (level[v] < 0) second.push_back(v);
+        }
+        for (int v : order) level[v] = -1;
+        if (first.empty() || (second.empty() && depth == 0)) {
+            std::copy(vertices.begin(), vertices.end(), perm.begin() + part.offset);
+            continue;
+        }
+        const int first_tag = next_label++, second_tag = next_label++;
+        for (int v : first) label[v] = first_tag;
+        for (int v : second) label[v] = second_tag;
+        for (int v : separator) label[v] = -1;
+        std::copy(separator.begin(), separator.end(), perm.begin() + part.offset + first.size() + second.size());
+        const int second_offset = part.offset + first.size();
+        work.push_back({std::move(second), second_tag, second_offset});
+        work.push_back({std::move(first), first_tag, part.offset});
+    }
+}
 
+struct SparseCholesky {
+    int n = 0;
+    std::vector<int> perm;                 // perm[k] = original index of unknown k
+    // Supernode s covers columns first[s] .. first[s+1]-1; its row structure (diagonal block
+    // first) is rows[row_start[s] .. row_start[s+1]) and L is stored dense, column-major,
+    // with leading dimension equal to the number of rows, at factor[factor_start[s]]
+    std::vector<int> first, row_start, rows, parent;
+    std::vector<size_t> factor_start;      // the factor can exceed 2^31 entries on large grids
+    std::vector<double> factor;
+    std::vector<std::vector<int>> children;
+    long long nnz_l = 0;
+
+    // Elimination tree of the matrix given by adjacency lists (lower parts are taken from them)
+    static std::vector<int> elimination_tree(const std::vector<std::vector<int>>& adjacency) {
+        const int n = adjacency.size();
+        std::vector<int> parent(n, -1), ancestor(n, -1);
         for (int j = 0; j < n; ++j) {
-            x[j] += alpha * p[j];
-            r[j] -= alpha * Ap[j];
+            for (int i : adjacency[j]) {
+                if (i >= j) continue;
+                int r = i;
+                while (ancestor[r] != -1 && ancestor[r] != j) {
+                    int t = ancestor[r];
+                    ancestor[r] = j;
+                    r = t;
+                }
+                if (ancestor[r] == -1) {
+                    ancestor[r] = j;
+                    parent[r] = j;
+                }
+            }
         }
+        return parent;
+    }
 
-        double rsnew = 0.0;
+    void analyse(const int* col_indices, const int* a_row_start, int n_) {
+        n = n_;
+        std::vector<int> nd;
+        nested_dissection_order(col_indices, a_row_start, n, nd);
+
+        // Postorder the elimination tree so that every subtree, and so every supernode, is a
+        // contiguous range of columns
+        std::vector<int> inverse(n);
+        auto permuted_adjacency = [&](const std::vector<int>& p, std::vector<std::vector<int>>& adjacency) {
+            for (int k = 0; k < n; ++k) inverse[p[k]] = k;
+            adjacency.assign(n, {});
+            for (int k = 0; k < n; ++k) {
+                const int i = p[k];
+                for (int j = a_row_start[i]; j < a_row_start[i + 1]; ++j) adjacency[k].push_back(inverse[col_indices[j]]);
+            }
+        };
+        std::vector<std::vector<int>> adjacency;
+        permuted_adjacency(nd, adjacency);
+        std::vector<int> etree = elimination_tree(adjacency);
+        std::vector<std::vector<int>> kids(n);
+        std::vector<int> roots;
         for (int j = 0; j < n; ++j) {
-            rsnew += r[j] * r[j];
+            if (etree[j] < 0) roots.push_back(j);
+            else kids[etree[j]].push_back(j);
+        }
+        std::vector<int> post;
+        post.reserve(n);
+        std::vector<std::pair<int, size_t>> stack;
+        for (int root : roots) {
+            stack.push_back({root, 0});
+            while (!stack.empty()) {
+                auto& top = stack.back();
+                if (top.second < kids[top.first].size()) {
+                    int child = kids[top.first][top.second++];
+                    stack.push_back({child, 0});
+                } else {
+                    post.push_back(top.first);
+                    stack.pop_back();
+                }
+            }
         }
+        perm.resize(n);
+        for (int k = 0; k < n; ++k) perm[k] = nd[post[k]];
+        permuted_adjacency(perm, adjacency);
+        etree = elimination_tree(adjacency);
 
-        if (sqrt(rsnew) < tolerance) {
-	    std::cout << "Final residual " << sqrt(rsnew) << std::endl;
-            break;
-        } else if (i%100 == 0) {
-	    std::cout << i << " residual " << sqrt(rsnew) << std::endl;
-	}
+        // Column structures: struct(L_j) = {i > j : a_ij != 0} U struct(L_c) \\ {j} over children c
+        std::vector<std::vector<int>> structure(n);
+        std::vector<int> mark(n, -1);
+        std::vector<std::vector<int>> column_children(n);
+        for (int j = 0; j < n; ++j) {
+            if (etree[j] >= 0) column_children[etree[j]].push_back(j);
+        }
+        for (int j = 0; j < n; ++j) {
+            std::vector<int>& s = structure[j];
+            mark[j] = j;
+            for (int i : adjacency[j]) {
+                if (i > j && mark[i] != j) {
+                    mark[i] = j;
+                    s.push_back(i);
+                }
+            }
+            for (int c : column_children[j]) {
+                for (int i : structure[c]) {
+                    if (i > j && mark[i] != j) {
+                        mark[i] = j;
+                        s.push_back(i);
+                    }
+                }
+            }
+            std::sort(s.begin(), s.end());
+        }
 
+        // Relaxed supernodes: column j joins the supernode of j-1 when it is j-1's parent and
+        // storing the merged columns as one dense block pads at most a few explicit zeros
+        first.clear();
+        long long true_count = 0;
         for (int j = 0; j < n; ++j) {
-            p[j] = r[j] + (rsnew / rsold) * p[j];
+            bool merge = false;
+            if (j > 0 && etree[j - 1] == j) {
+                const long long width = j - first.back() + 1;
+                const long long merged_stored = width * structure[j].size() + width * (width + 1) / 2;
+                const long long merged_true = true_count + structure[j].size() + 1;
+                const long long zeros = merged_stored - merged_true;
+                merge = zeros == 0 || (width <= 32 && zeros <= merged_stored / 8);
+                if (merge) true_count = merged_true;
+            }
+            if (!merge) {
+                first.push_back(j);
+                true_count = structure[j].size() + 1;
+            }
         }
+        const int nsuper = first.size();
+        first.push_back(n);
+        std::vector<int> supernode_of(n);
+        for (int s = 0; s < nsuper; ++s)
+            for (int j = first[s]; j < first[s + 1]; ++j) supernode_of[j] = s;
 
-        rsold = rsnew;
+        row_start.assign(nsuper + 1, 0);
+        factor_start.assign(nsuper + 1, 0);
+        rows.clear();
+        parent.assign(nsuper, -1);
+        children.assign(nsuper, {});
+        nnz_l = 0;
+        for (int s = 0; s < nsuper; ++s) {
+            const int last = first[s + 1] - 1;
+            for (int j = first[s]; j <= last; ++j) rows.push_back(j);
+            rows.insert(rows.end(), structure[last].begin(), structure[last].end());
+            row_start[s + 1] = rows.size();
+            const long long m = row_start[s + 1] - row_start[s];
+            const long long ncols = first[s + 1] - first[s];
+            factor_start[s + 1] = factor_start[s] + m * ncols;
+            nnz_l += m * ncols - ncols * (ncols - 1) / 2;
+            if (etree[last] >= 0) {
+                parent[s] = supernode_of[etree[last]];
+                children[parent[s]].push_back(s);
+            }
+        }
     }
 
-    delete[] r;
-    delete[] p;
-    delete[] Ap;
-    delete[] Ax;
+    // Right-looking partial Cholesky of the first ncols columns of the m x m front F (lower,
+    // column-major), in panels of nb columns: factor a panel, then update the trailing
+    // columns with it. Afterwards F(:, 0:ncols) holds L and F(ncols:, ncols:) the update matrix.
+    static void partial_cholesky(double* F, int m, int ncols) {
+        const int nb = 32;
+        for (int p0 = 0; p0 < ncols; p0 += nb) {
+            const int p1 = std::min(p0 + nb, ncols);
+            for (int j = p0; j < p1; ++j) {
+                double* cj = F + (size_t)j * m;
+                const double d = sqrt(cj[j]);
+                cj[j] = d;
+                for (int i = j + 1; i < m; ++i) cj[i] /= d;
+                for (int k = j + 1; k < p1; ++k) {
+                    double* ck = F + (size_t)k * m;
+                    const double l = cj[k];
+                    #pragma omp simd
+                    for (int i = k; i < m; ++i) ck[i] -= l * cj[i];
+                }
+            }
+            // Trailing update with the whole panel, column by column
+            for (int k = p1; k < m; ++k) {
+                double* ck = F + (size_t)k * m;
+                for (int j = p0; j < p1; ++j) {
+                    const double* cj = F + (size_t)j * m;
+                    const double l = cj[k];
+                    #pragma omp simd
+                    for (int i = k; i < m; ++i) ck[i] -= l * cj[i];
+                }
+            }
+        }
+    }
+
+    void factorise_supernode(int s, const std::vector<double>& permuted_values, const std::vector<int>& permuted_cols,
+                             const std::vector<int>& permuted_rows, std::vector<std::vector<double>>& updates, std::vector<int>& position) {
+        const int m = row_start[s + 1] - row_start[s];
+        const int ncols = first[s + 1] - first[s];
+        const int* r = &rows[row_start[s]];
+        for (int a = 0; a < m; ++a) position[r[a]] = a;
+        std::vector<double> F((size_t)m * m, 0.0);
+        // Lower-triangular entries of A in this supernode's columns
+        for (int c = 0; c < ncols; ++c) {
+            const int col = first[s] + c;
+            for (int j = permuted_rows[col]; j < permuted_rows[col + 1]; ++j) {
+                const int row = permuted_cols[j];
+                if (row >= col) F[(size_t)c * m + position[row]] += permuted_values[j];
+            }
+        }
+        // Extend-add of the children's update matrices
+        for (int child : children[s]) {
+            const int cm = row_start[child + 1] - row_start[child];
+            const int cn = first[child + 1] - first[child];
+            const int mu = cm - cn;
+            const int* cr = &rows[row_start[child] + cn];
+            const std::vector<double>& U = updates[child];
+            for (int b = 0; b < mu; ++b) {
+                double* column = &F[(size_t)position[cr[b]] * m];
+                for (int a = b; a < mu; ++a) column[position[cr[a]]] += U[(size_t)b * mu + a];
+            }
+            std::vector<double>().swap(updates[child]);
+        }
+        partial_cholesky(F.data(), m, ncols);
+        std::copy(F.begin(), F.begin() + (size_t)m * ncols, factor.begin() + factor_start[s]);
+        const int mu = m - ncols;
+        if (mu > 0) {
+            std::vector<double>& U = updates[s];
+            U.resize((size_t)mu * mu);
+            for (int b = 0; b < mu; ++b)
+                for (int a = b; a < mu; ++a) U[(size_t)b * mu + a] = F[(size_t)(ncols + b) * m + ncols + a];
+        }
+    }
+
+    void factorise(const double* values, const int* col_indices, const int* a_row_start) {
+        // A in the new ordering, CSR by (permuted) row
+        std::vector<int> inverse(n);
+        for (int k = 0; k < n; ++k) inverse[perm[k]] = k;
+        std::vector<int> permuted_rows(n + 1, 0), permuted_cols;
+        std::vector<double> permuted_values;
+        for (int k = 0; k < n; ++k) {
+            const int i = perm[k];
+            for (int j = a_row_start[i]; j < a_row_start[i + 1]; ++j) {
+                permuted_cols.push_back(inverse[col_indices[j]]);
+                permuted_values.push_back(values[j]);
+            }
+            permuted_rows[k + 1] = permuted_cols.size();
+        }
+        // A is symmetric, so row k of the permuted matrix is also its column k
+
+        const int nsuper = first.size() - 1;
+        factor.assign(factor_start[nsuper], 0.0);
+        std::vector<std::vector<double>> updates(nsuper);
+        std::vector<std::vector<int>> positions(omp_get_max_threads(), std::vector<int>());
+
+        // Tree parallelism without recursion: a task starts at every leaf supernode and walks
+        // up the tree; the last child to finish carries on with its parent
+        std::vector<int> pending(nsuper);
+        for (int s = 0; s < nsuper; ++s) pending[s] = children[s].size();
+        #pragma omp parallel
+        #pragma omp single
+        {
+            for (int leaf = 0; leaf < nsuper; ++leaf) {
+                if (!children[leaf].empty()) continue;
+                #pragma omp task firstprivate(leaf) shared(pending, updates, positions, permuted_values, permuted_cols, permuted_rows)
+                {
+                    std::vector<int>& position = positions[omp_get_thread_num()];
+                    if (position.empty()) position.resize(n);
+                    int s = leaf;
+                    while (true) {
+                        factorise_supernode(s, permuted_values, permuted_cols, permuted_rows, updates, position);
+                        const int p = parent[s];
+                        if (p < 0) break;
+                        int left;
+                        #pragma omp atomic capture seq_cst
+                        left = --pending[p];
+                        if (left != 0) break;
+                        s = p;
+                    }
+                }
+            }
+            #pragma omp taskwait
+        }
+    }
+
+    // x = A^-1 b with the stored factor: permute, forward and backward supernodal sweeps
+    void solve(const double* b, double* x) const {
+        const int nsuper = first.size() - 1;
+        std::vector<double> y(n);
+        for (int k = 0; k < n; ++k) y[k] = b[perm[k]];
+        for (int s = 0; s < nsuper; ++s) {
+            const int m = row_start[s + 1] - row_start[s];
+            const int ncols = first[s + 1] - first[s];
+            const double* L = &factor[factor_start[s]];
+            const int* r = &rows[row_start[s]];
+            double* ys = &y[first[s]];
+            for (int c = 0; c < ncols; ++c) {
+                ys[c] /= L[(size_t)c * m + c];
+                const double v = ys[c];
+                for (int a = c + 1; a < ncols; ++a) ys[a] -= L[(size_t)c * m + a] * v;
+                for (int a = ncols; a < m; ++a) y[r[a]] -= L[(size_t)c * m + a] * v;
+            }
+        }
+        for (int s = nsuper - 1; s >= 0; --s) {
+            const int m = row_start[s + 1] - row_start[s];
+            const int ncols = first[s + 1] - first[s];
+            const double* L = &factor[factor_start[s]];
+            const int* r = &rows[row_start[s]];
+            double* ys = &y[first[s]];
+            for (int c = ncols - 1; c >= 0; --c) {
+                double sum = ys[c];
+                for (int a = ncols; a < m; ++a) sum -= L[(size_t)c * m + a] * y[r[a]];
+                for (int a = c + 1; a < ncols; ++a) sum -= L[(size_t)c * m + a] * ys[a];
+                ys[c] = sum / L[(size_t)c * m + c];
+            }
+        }
+        for (int k = 0; k < n; ++k) x[perm[k]] = y[k];
+    }
+};
+
+// ------------------------------------------------------------
+// Solver daemon: the matrix and CG workspace stay resident, clients exchange right-hand sides
+// and solutions through a shared-memory segment and only send small control messages over a
+// Unix domain socket. CG reads b from and writes x into the shared segment directly.
+// ------------------------------------------------------------
+const char* DAEMON_SOCKET_PATH = "/tmp/cg_solver.sock";
+const char* DAEMON_SHM_NAME = "/cg_solver_shm";
+
+// Layout of the shared segment: header, then b[n], then x[n]
+struct DaemonSharedHeader {
+    int n;
+    int gridSize;
+};
+
+struct SolveRequest {
+    int max_iterations;   // < 0 asks the daemon to shut down
+    double tolerance;
+    int warm_start;       // nonzero: start from the x left in shared memory by the previous solve
+};
+
+struct SolveReply {
+    int iterations;
+    double residual;
+    double milliseconds;
+};
+
+size_t daemon_shm_size(int n) {
+    return sizeof(DaemonSharedHeader) + 2 * (size_t)n * sizeof(double);
 }
 
-void matrix_vector_multiply_csr(const double* values, const int* col_indices, const int* row_start, const double* x, double* result, int n) {
-    for (int i = 0; i < n; ++i) {
-        result[i] = 0.0;
-        for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
-            result[i] += values[j] * x[col_indices[j]];
+// Reads or writes exactly `size` bytes on a socket, returns false if the peer went away.
+// MSG_NOSIGNAL keeps a client that disconnects before its reply from raising SIGPIPE in the
+// daemon; calls interrupted by a signal are retried.
+bool transfer_all(int fd, void* buffer, size_t size, bool writing) {
+    char* p = (char*)buffer;
+    while (size > 0) {
+        ssize_t done = writing ? send(fd, p, size, MSG_NOSIGNAL) : recv(fd, p, size, 0);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) return false;
+        p += done;
+        size -= done;
+    }
+    return true;
+}
+
+int run_solver_daemon(LinearOperator& A, int n, int gridSize) {
+    int shm_fd = shm_open(DAEMON_SHM_NAME, O_CREAT | O_RDWR, 0600);
+    if (shm_fd < 0 || ftruncate(shm_fd, daemon_shm_size(n)) != 0) {
+        perror("shm_open");
+        return 1;
+    }
+    char* shm = (char*)mmap(nullptr, daemon_shm_size(n), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    DaemonSharedHeader* header = (DaemonSharedHeader*)shm;
+    header->n = n;
+    header->gridSize = gridSize;
+    double* b = (double*)(shm + sizeof(DaemonSharedHeader));
+    double* x = b + n;
+    std::fill(x, x + n, 0.0);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, DAEMON_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    unlink(DAEMON_SOCKET_PATH);
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 4) != 0) {
+        perror("socket");
+        return 1;
+    }
+    std::cout << "Solver daemon ready: n = " << n << ", socket " << DAEMON_SOCKET_PATH << ", shm " << DAEMON_SHM_NAME << std::endl;
+
+    CGWorkspace workspace;
+    workspace.resize(n);
+    bool running = true;
+    int status = 0;
+    while (running) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            // A signal or a client that hung up before being accepted: just retry. Running out
+            // of descriptors or memory may pass, so back off; anything else will not.
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            status = 1;
+            break;
+        }
+        SolveRequest request;
+        while (transfer_all(fd, &request, sizeof(request), false)) {
+            if (request.max_iterations < 0) {
+                running = false;
+                break;
+            }
+            auto t1 = std::chrono::high_resolution_clock::now();
+            if (!request.warm_start) std::fill(x, x + n, 0.0);
+            SolveReply reply;
+            reply.iterations = conjugate_gradient(A, b, x, n, request.max_iterations, request.tolerance, nullptr, &workspace);
+            // True residual of the returned solution, reusing the workspace
+            double* r = workspace.Ax.data();
+            A.apply(x, r, n);
+            #pragma omp parallel for
+            for (int i = 0; i < n; ++i) r[i] = b[i] - r[i];
+            reply.residual = sqrt(dot_product(r, r, n));
+            auto t2 = std::chrono::high_resolution_clock::now();
+            reply.milliseconds = std::chrono::duration<double, std::milli>(t2 - t1).count();
+            if (!transfer_all(fd, &reply, sizeof(reply), true)) break;
         }
+        close(fd);
     }
+
+    close(listen_fd);
+    unlink(DAEMON_SOCKET_PATH);
+    munmap(shm, daemon_shm_size(n));
+    shm_unlink(DAEMON_SHM_NAME);
+    return status;
 }
 
+// Example client: writes a right-hand side into shared memory, requests a cold solve and a
+// warm-started re-solve after perturbing b, then optionally shuts the daemon down.
+int run_solver_client(bool shutdown) {
+    int shm_fd = shm_open(DAEMON_SHM_NAME, O_RDWR, 0600);
+    if (shm_fd < 0) {
+        perror("shm_open (is the daemon running?)");
+        return 1;
+    }
+    DaemonSharedHeader header;
+    if (read(shm_fd, &header, sizeof(header)) != sizeof(header)) {
+        perror("read");
+        return 1;
+    }
+    const int n = header.n;
+    char* shm = (char*)mmap(nullptr, daemon_shm_size(n), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    double* b = (double*)(shm + sizeof(DaemonSharedHeader));
+    double* x = b + n;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, DAEMON_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        return 1;
+    }
+
+    for (int solve = 0; solve < 3; ++solve) {
+        // Right-hand side that changes a little between solves, as in a time-stepping sequence
+        for (int i = 0; i < n; ++i) b[i] = 1.0 + 0.01 * solve;
+        SolveRequest request = {1000, 1e-8, solve > 0};
+        SolveReply reply;
+        auto t1 = std::chrono::high_resolution_clock::now();
+        if (!transfer_all(fd, &request, sizeof(request), true) || !transfer_all(fd, &reply, sizeof(reply), false)) {
+            std::cerr << "Daemon closed the connection" << std::endl;
+            return 1;
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+        std::cout << (request.warm_start ? "Warm" : "Cold") << " solve: " << reply.iterations << " iterations, residual "
+                  << reply.residual << ", solve " << reply.milliseconds << "ms, round trip "
+                  << std::chrono::duration<double, std::milli>(t2 - t1).count() << "ms, x[n/2] = " << x[n / 2] << std::endl;
+    }
+    if (shutdown) {
+        SolveRequest request = {-1, 0.0, 0};
+        transfer_all(fd, &request, sizeof(request), true);
+    }
+    close(fd);
+    munmap(shm, daemon_shm_size(n));
+    return 0;
+}
 
-int main() {
-    const int gridSize = 2000;
+// Usage: ./cg [variant] [gridSize] [overlap]
+//   variant: cg (default), chebyshev, pcg-chebyshev, cg-dia, cg-dict, cg-binned, pcg-mcsgs, pcg-mcsgs-jp,
+//            pcg-schwarz, pcg-schwarz-banded (overlap in rows, default 0),
+//            batched-cg (argv[3] = number of systems of size gridSize^2, default 20000; gridSize
+//            defaults to 16 here, and the batch is capped at BATCHED_CG_MAX_BYTES of storage),
+//            daemon (keep the matrix resident and serve solves), client, client-shutdown,
+//            cg-lanczos (spectrum estimate from the CG coefficients), chebyshev-lanczos,
+//            cg-merge (merge-path SpMV), spmv-skewed (row- vs merge-path SpMV on a power-law matrix),
+//            deflated-cg (sequence of related solves, argv[3] = deflation subspace size, default 8),
+//            cg-autotune (SpMV kernel picked by the autotuner, cached in spmv_tuning.cache),
+//            pcg-fsai (argv[3] = sparsity level of the FSAI pattern, default 1),
+//            spgemm (A^2, A^3 and a Galerkin product R A P, reporting throughput),
+//            cholesky (sparse direct solve, argv[3] = number of right-hand sides, default 100),
+//            cg-telemetry (per-iteration records to cg_telemetry.bin and shared memory),
+//            monitor (follow a running cg-telemetry solve),
+//            cg-checkpoint (interrupted and resumed solve, argv[3] = checkpoint interval in
+//            iterations, default 100, argv[4] = interval in seconds, default off),
+//            bicgstab, gmres (nonsymmetric convection-diffusion instead of the Laplacian,
+//            argv[3] = cell Peclet number, default 1, argv[4] = GMRES restart length, default 30)
+//        ./cg bench [report.json]   runs the benchmark suite
+int main(int argc, char** argv) {
+    const std::string variant = argc > 1 ? argv[1] : "cg";
+    if (variant == "bench") {
+        return run_benchmark_suite(argc > 2 ? argv[2] : "bench_report.json");
+    }
+    if (variant == "client" || variant == "client-shutdown") {
+        return run_solver_client(variant == "client-shutdown");
+    }
+    if (variant == "monitor") {
+        return run_telemetry_monitor();
+    }
+    // The batched solver is meant for many small systems; 20000 copies of the default 2000x2000
+    // grid would need terabytes
+    const int gridSize = argc > 2 ? std::atoi(argv[2]) : (variant == "batched-cg" ? 16 : 2000);
     const int n = gridSize * gridSize;
     std::vector<double> values;
     std::vector<int> col_indices;
@@ -121,11 +3668,384 @@ int main() {
     double* b_array = &b[0];
     double* x_array = &x[0];
 
+    if (variant == "daemon") {
+        StencilOperator A(val_array, col_array, row_start_array, n);
+        return run_solver_daemon(A, n, gridSize);
+    }
+
     // Solve the system using a CSR-based Conjugate Gradient method
     int max_iterations = 1000;
     double tolerance = 1e-8;
+    // Spectrum bounds of the 5-point Laplacian: 4 -+ 4cos(pi/(gridSize+1)). The polynomial
+    // preconditioner does not use them: it takes lambda_max from the Gershgorin bound and
+    // lambda_min from a Lanczos estimate, both computed from the matrix.
+    const double lambda_min = 4.0 - 4.0 * cos(M_PI / (gridSize + 1));
+    const double lambda_max = 4.0 + 4.0 * cos(M_PI / (gridSize + 1));
+    const int chebyshev_degree = 8;
+    int iterations = 0;
     auto t1 = std::chrono::high_resolution_clock::now();
-    conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_array, n, max_iterations, tolerance);
+    if (variant == "chebyshev") {
+        iterations = chebyshev_iteration_csr(val_array, col_array, row_start_array, b_array, x_array, n, lambda_min, lambda_max,
+                                             100 * max_iterations, tolerance, 10);
+    } else if (variant == "pcg-chebyshev") {
+        double lmax = gershgorin_lambda_max_csr(val_array, row_start_array, n);
+        // The smallest Ritz value of a short CG run overestimates lambda_min, so it is widened
+        CGHistory history;
+        std::vector<double> x_probe(n, 0.0);
+        const int probe_iterations = conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_probe.data(), n,
+                                                            50, 0.0, nullptr, &history, false);
+        const double lmin = 0.5 * lanczos_spectral_estimate(history).lambda_min;
+        std::cout << "Gershgorin lambda_max " << lmax << " (exact " << lambda_max << "), Lanczos lambda_min " << lmin
+                  << " (exact " << lambda_min << ")" << std::endl;
+        ChebyshevPreconditioner precond(val_array, col_array, row_start_array, n, chebyshev_degree, lmin, lmax);
+        iterations = conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_array, n, max_iterations, tolerance, &precond);
+        // CG: the initial residual and one product per iteration, plus the Lanczos probe
+        const long long cg_spmvs = 1 + iterations + 1 + probe_iterations;
+        std::cout << "SpMVs " << cg_spmvs + precond.spmvs << " (CG and probe " << cg_spmvs << ", preconditioner " << precond.spmvs
+                  << ") for degree " << chebyshev_degree << std::endl;
+    } else if (variant == "cg-dia") {
+        StencilOperator A(val_array, col_array, row_start_array, n);
+        if (A.use_dia) {
+            std::cout << "DIA format with " << A.dia.offsets.size() << " diagonals, offsets";
+            for (int offset : A.dia.offsets) std::cout << " " << offset;
+            std::cout << std::endl;
+        } else {
+            std::cout << "Matrix is not banded, falling back to CSR" << std::endl;
+        }
+        iterations = conjugate_gradient(A, b_array, x_array, n, max_iterations, tolerance);
+    } else if (variant == "cg-dict") {
+        DictCSROperator A(val_array, col_array, row_start_array, n);
+        if (A.use_dict) {
+            // Per nonzero: 8+4 bytes in CSR versus 1+4 bytes here, plus the row pointers
+            double csr_bytes = 12.0 * nnz + 4.0 * (n + 1);
+            double dict_bytes = 5.0 * nnz + 4.0 * (n + 1) + 8.0 * A.dict.dictionary.size();
+            std::cout << "Dictionary CSR with " << A.dict.dictionary.size() << " distinct values, matrix bytes "
+                      << dict_bytes / 1e6 << " MB vs " << csr_bytes / 1e6 << " MB" << std::endl;
+        } else {
+            std::cout << "Too many distinct values, falling back to CSR" << std::endl;
+        }
+        iterations = conjugate_gradient(A, b_array, x_array, n, max_iterations, tolerance);
+    } else if (variant == "cg-binned") {
+        BinnedCSROperator A(val_array, col_array, row_start_array, n);
+        std::vector<double> y(n);
+        A.matrix.tune_prefetch(b_array, y.data());
+        std::cout << "Row-length bins:" << std::endl;
+        A.matrix.report(b_array, y.data());
+        iterations = conjugate_gradient(A, b_array, x_array, n, max_iterations, tolerance);
+    } else if (variant == "pcg-mcsgs" || variant == "pcg-mcsgs-jp") {
+        std::vector<double> x_plain(n, 0.0);
+        int plain_iterations = conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_plain.data(), n, max_iterations, tolerance);
+        auto tc1 = std::chrono::high_resolution_clock::now();
+        MulticolourSGSPreconditioner precond(val_array, col_array, row_start_array, n, variant == "pcg-mcsgs-jp");
+        auto tc2 = std::chrono::high_resolution_clock::now();
+        std::cout << "Colours " << precond.colours << ", setup "
+                  << std::chrono::duration<double, std::milli>(tc2 - tc1).count() << "ms" << std::endl;
+        iterations = conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_array, n, max_iterations, tolerance, &precond);
+        std::cout << "Plain CG iterations " << plain_iterations << ", multicolour SGS PCG iterations " << iterations
+                  << ", " << 1e3 * precond.apply_seconds / precond.applications << "ms per application" << std::endl;
+    } else if (variant == "pcg-schwarz" || variant == "pcg-schwarz-banded") {
+        const int overlap = argc > 3 ? std::atoi(argv[3]) : 0;
+        LocalSolver solver = variant == "pcg-schwarz" ? LocalSolver::ilu0 : LocalSolver::banded_cholesky;
+        SchwarzPreconditioner precond(val_array, col_array, row_start_array, n, overlap, solver);
+        std::cout << precond.blocks.size() << " blocks, overlap " << precond.overlap << " rows, "
+                  << (solver == LocalSolver::ilu0 ? "ILU(0)" : "banded Cholesky") << " local solves" << std::endl;
+        if (precond.fallback_blocks > 0) {
+            std::cout << precond.fallback_blocks << " blocks exceed the banded Cholesky limit of "
+                      << BANDED_CHOLESKY_MAX_ENTRIES << " band entries and use ILU(0)" << std::endl;
+        }
+        iterations = conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_array, n, max_iterations, tolerance, &precond);
+    } else if (variant == "batched-cg") {
+        // Same pattern, different coefficients: system s gets a diagonal shift of 0.01*(s % 100)
+        const int requested_systems = argc > 3 ? std::atoi(argv[3]) : 20000;
+        // Per system: its matrix values, b, the batched and the looped x, and the 4n solver workspace
+        const size_t bytes_per_system = sizeof(double) * ((size_t)nnz + 7 * (size_t)n);
+        const int nsystems = (int)std::min<size_t>(requested_systems, std::max<size_t>(1, BATCHED_CG_MAX_BYTES / bytes_per_system));
+        if (nsystems < requested_systems) {
+            std::cout << "Batch capped at " << nsystems << " systems (" << bytes_per_system << " bytes each, limit "
+                      << BATCHED_CG_MAX_BYTES << " bytes)" << std::endl;
+        }
+        std::vector<double> batch_values((size_t)nsystems * nnz), batch_b((size_t)nsystems * n, 1.0);
+        std::vector<double> batch_x((size_t)nsystems * n, 0.0), loop_x((size_t)nsystems * n, 0.0);
+        std::vector<int> batch_iterations(nsystems), loop_iterations(nsystems);
+        for (int s = 0; s < nsystems; ++s) {
+            for (int i = 0; i < n; ++i) {
+                for (int j = row_start[i]; j < row_start[i + 1]; ++j) {
+                    batch_values[(size_t)s * nnz + j] = values[j] + (col_indices[j] == i ? 0.01 * (s % 100) : 0.0);
+                }
+            }
+        }
+        auto tb1 = std::chrono::high_resolution_clock::now();
+        batched_conjugate_gradient_csr<8>(batch_values.data(), col_array, row_start_array, batch_b.data(), batch_x.data(),
+                                          n, nsystems, max_iterations, tolerance, batch_iterations.data());
+        auto tb2 = std::chrono::high_resolution_clock::now();
+        // Reference: one quiet conjugate_gradient_csr call per system
+        #pragma omp parallel for schedule(dynamic)
+        for (int s = 0; s < nsystems; ++s) {
+            loop_iterations[s] = conjugate_gradient_csr(&batch_values[(size_t)s * nnz], col_array, row_start_array, &batch_b[(size_t)s * n],
+                                                        &loop_x[(size_t)s * n], n, max_iterations, tolerance, nullptr, nullptr, false);
+        }
+        auto tb3 = std::chrono::high_resolution_clock::now();
+        double max_diff = 0.0;
+        for (size_t k = 0; k < batch_x.size(); ++k) max_diff = std::max(max_diff, fabs(batch_x[k] - loop_x[k]));
+        double batched_s = std::chrono::duration<double>(tb2 - tb1).count();
+        double loop_s = std::chrono::duration<double>(tb3 - tb2).count();
+        std::cout << "Batched CG: " << nsystems / batched_s << " systems/s, looped conjugate_gradient_csr: " << nsystems / loop_s
+                  << " systems/s, max |x_batched - x_loop| " << max_diff << std::endl;
+        iterations = batch_iterations[0];
+    } else if (variant == "cg-lanczos") {
+        CGHistory history;
+        iterations = conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_array, n, max_iterations, tolerance, nullptr, &history);
+        for (int k : {10, 30, 100, iterations}) {
+            if (k > iterations) continue;
+            CGHistory partial;
+            partial.alpha.assign(history.alpha.begin(), history.alpha.begin() + k);
+            partial.beta.assign(history.beta.begin(), history.beta.begin() + std::min<size_t>(k, history.beta.size()));
+            SpectralEstimate estimate = lanczos_spectral_estimate(partial);
+            std::cout << "After " << k << " iterations: lambda_min " << estimate.lambda_min << ", lambda_max " << estimate.lambda_max
+                      << ", condition " << estimate.condition << std::endl;
+        }
+        SpectralEstimate estimate = lanczos_spectral_estimate(history);
+        std::cout << "Exact: lambda_min " << lambda_min << ", lambda_max " << lambda_max << ", condition " << lambda_max / lambda_min << std::endl;
+        // Relative residual reduction used as a proxy for the A-norm error reduction
+        std::cout << "Predicted iterations (upper bound) " << estimate.predicted_iterations(tolerance / sqrt((double)n)) << std::endl;
+    } else if (variant == "chebyshev-lanczos") {
+        // A short CG run harvests the bounds; lambda_min is widened because Ritz values lie inside the spectrum
+        CGHistory history;
+        std::vector<double> x_probe(n, 0.0);
+        conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_probe.data(), n, 50, 0.0, nullptr, &history, false);
+        SpectralEstimate estimate = lanczos_spectral_estimate(history);
+        std::cout << "Lanczos bounds from 50 CG iterations: [" << estimate.lambda_min << ", " << estimate.lambda_max << "]" << std::endl;
+        iterations = chebyshev_iteration_csr(val_array, col_array, row_start_array, b_array, x_array, n, 0.5 * estimate.lambda_min,
+                                             1.02 * estimate.lambda_max, 100 * max_iterations, tolerance, 10);
+    } else if (variant == "cg-merge") {
+        MergePathOperator A(val_array, col_array, row_start_array);
+        iterations = conjugate_gradient(A, b_array, x_array, n, max_iterations, tolerance);
+    } else if (variant == "spmv-skewed") {
+        std::vector<double> skew_values;
+        std::vector<int> skew_cols, skew_rows;
+        build_power_law_csr(n, n / 10, 1.0, 12345u, skew_values, skew_cols, skew_rows);
+        std::vector<double> y_rows(n), y_merge(n);
+        const int repetitions = 10;
+        auto ts1 = std::chrono::high_resolution_clock::now();
+        for (int rep = 0; rep < repetitions; ++rep) {
+            // Row-partitioned SpMV: each thread gets n/threads rows whatever their length
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < n; ++i) {
+                double sum = 0.0;
+                for (int j = skew_rows[i]; j < skew_rows[i + 1]; ++j) sum += skew_values[j] * b[skew_cols[j]];
+                y_rows[i] = sum;
+            }
+        }
+        auto ts2 = std::chrono::high_resolution_clock::now();
+        for (int rep = 0; rep < repetitions; ++rep) {
+            matrix_vector_multiply_merge_path(skew_values.data(), skew_cols.data(), skew_rows.data(), b_array, y_merge.data(), n);
+        }
+        auto ts3 = std::chrono::high_resolution_clock::now();
+        double max_diff = 0.0;
+        for (int i = 0; i < n; ++i) max_diff = std::max(max_diff, fabs(y_rows[i] - y_merge[i]) / std::max(1.0, fabs(y_rows[i])));
+        std::cout << "Power-law matrix: nnz " << skew_rows[n] << ", longest row " << skew_rows[1] - skew_rows[0]
+                  << ", row-partitioned " << std::chrono::duration<double, std::milli>(ts2 - ts1).count() / repetitions
+                  << "ms, merge-path " << std::chrono::duration<double, std::milli>(ts3 - ts2).count() / repetitions
+                  << "ms, max relative difference " << max_diff << std::endl;
+        MergePathOperator A(skew_values.data(), skew_cols.data(), skew_rows.data());
+        iterations = conjugate_gradient(A, b_array, x_array, n, max_iterations, tolerance);
+    } else if (variant == "deflated-cg") {
+        // Time-stepping-like sequence: the right-hand side drifts a little between solves
+        const int subspace_size = argc > 3 ? std::atoi(argv[3]) : 8;
+        const int steps = 8;
+        CSROperator A(val_array, col_array, row_start_array);
+        DeflatedCG deflated(A, n, subspace_size, 3 * subspace_size);
+        std::vector<double> x_plain(n), x_deflated(n), rhs(n);
+        int plain_total = 0, deflated_total = 0;
+        for (int step = 0; step < steps; ++step) {
+            for (int i = 0; i < n; ++i) rhs[i] = 1.0 + 0.1 * sin(0.3 * step + 7.0 * i / n);
+            std::fill(x_plain.begin(), x_plain.end(), 0.0);
+            std::fill(x_deflated.begin(), x_deflated.end(), 0.0);
+            int plain = conjugate_gradient(A, rhs.data(), x_plain.data(), n, max_iterations, tolerance, nullptr, nullptr, nullptr,
+                                           nullptr, nullptr, false);
+            int deflated_iterations = deflated.solve(rhs.data(), x_deflated.data(), max_iterations, tolerance);
+            plain_total += plain;
+            deflated_total += deflated_iterations;
+            std::cout << "Solve " << step << ": plain CG " << plain << " iterations, deflated CG " << deflated_iterations
+                      << " iterations (" << deflated.k << " deflation vectors)" << std::endl;
+        }
+        std::cout << "Total iterations: plain " << plain_total << ", deflated " << deflated_total << ", reduction "
+                  << 100.0 * (plain_total - deflated_total) / plain_total << "%" << std::endl;
+        x = x_deflated;
+        iterations = deflated_total;
+    } else if (variant == "cg-autotune") {
+        auto ta1 = std::chrono::high_resolution_clock::now();
+        AutotunedOperator A(val_array, col_array, row_start_array, n);
+        auto ta2 = std::chrono::high_resolution_clock::now();
+        std::cout << (A.from_cache ? "Cached" : "Tuned") << " SpMV: " << spmv_format_name(A.tuning.format) << ", "
+                  << A.tuning.threads << " threads, " << A.tuning.milliseconds << "ms per SpMV (setup "
+                  << std::chrono::duration<double, std::milli>(ta2 - ta1).count() << "ms)" << std::endl;
+        if (A.binned) {
+            std::cout << "Prefetch distances by row length:";
+            for (int L = 0; L <= MAX_FIXED_ROW_LENGTH; ++L) std::cout << " " << A.binned->prefetch_distance[L];
+            std::cout << std::endl;
+        }
+        iterations = conjugate_gradient(A, b_array, x_array, n, max_iterations, tolerance);
+    } else if (variant == "pcg-fsai") {
+        const int level = argc > 3 ? std::atoi(argv[3]) : 1;
+        auto tf1 = std::chrono::high_resolution_clock::now();
+        FSAIPreconditioner precond(val_array, col_array, row_start_array, n, level);
+        auto tf2 = std::chrono::high_resolution_clock::now();
+        std::cout << "FSAI level " << level << ": nnz(G) " << precond.G.row_start[n] << ", setup "
+                  << std::chrono::duration<double, std::milli>(tf2 - tf1).count() << "ms" << std::endl;
+        iterations = conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_array, n, max_iterations, tolerance, &precond);
+    } else if (variant == "spgemm") {
+        CSRMatrix A;
+        A.n = n;
+        A.values = values;
+        A.col_indices = col_indices;
+        A.row_start = row_start;
+        // Piecewise-constant aggregation of 2x2 blocks of grid points for the Galerkin product
+        const int coarse = (gridSize + 1) / 2;
+        CSRMatrix P;
+        P.n = n;
+        P.row_start.resize(n + 1);
+        for (int i = 0; i < n; ++i) {
+            P.row_start[i] = i;
+            P.col_indices.push_back((i / gridSize / 2) * coarse + (i % gridSize) / 2);
+            P.values.push_back(1.0);
+        }
+        P.row_start[n] = n;
+        CSRMatrix R = transpose_csr(P, coarse * coarse);
+
+        auto timed = [](const char* name, const CSRMatrix& X, const CSRMatrix& Y) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+            CSRMatrix Z = spgemm_csr(X, Y);
+            auto t2 = std::chrono::high_resolution_clock::now();
+            double s = std::chrono::duration<double>(t2 - t1).count();
+            long long flops = spgemm_flops(X, Y);
+            std::cout << name << ": nnz " << Z.row_start[Z.n] << ", " << s * 1e3 << "ms, " << 2.0 * flops / s / 1e9 << " GFLOP/s, "
+                      << X.row_start[X.n] / s / 1e6 << " M input nonzeros/s" << std::endl;
+            return Z;
+        };
+        CSRMatrix A2 = timed("A*A", A, A);
+        CSRMatrix A3 = timed("A^2*A", A2, A);
+        CSRMatrix AP = timed("A*P", A, P);
+        CSRMatrix RAP = timed("R*(AP)", R, AP);
+        // Check A^2 x == A (A x)
+        std::vector<double> t(n), y1(n), y2(n);
+        for (int i = 0; i < n; ++i) t[i] = sin(0.01 * i);
+        matrix_vector_multiply_csr(A2.values.data(), A2.col_indices.data(), A2.row_start.data(), t.data(), y1.data(), n);
+        matrix_vector_multiply_csr(val_array, col_array, row_start_array, t.data(), y2.data(), n);
+        matrix_vector_multiply_csr(val_array, col_array, row_start_array, y2.data(), t.data(), n);
+        double max_diff = 0.0;
+        for (int i = 0; i < n; ++i) max_diff = std::max(max_diff, fabs(y1[i] - t[i]));
+        std::cout << "Coarse operator " << RAP.n << " x " << RAP.n << ", max |A^2 x - A(Ax)| " << max_diff << std::endl;
+    } else if (variant == "cg-telemetry") {
+        CSROperator A(val_array, col_array, row_start_array);
+        std::vector<double> x_plain(n, 0.0);
+        auto tp1 = std::chrono::high_resolution_clock::now();
+        conjugate_gradient(A, b_array, x_plain.data(), n, max_iterations, tolerance, nullptr, nullptr, nullptr, nullptr, nullptr, false);
+        auto tp2 = std::chrono::high_resolution_clock::now();
+        SolverTelemetry telemetry(4096, "cg_telemetry.bin", TELEMETRY_SHM_NAME);
+        auto tt1 = std::chrono::high_resolution_clock::now();
+        iterations = conjugate_gradient(A, b_array, x_array, n, max_iterations, tolerance, nullptr, nullptr, nullptr, &telemetry);
+        telemetry.finish();
+        auto tt2 = std::chrono::high_resolution_clock::now();
+        std::vector<TelemetryRecord> log;
+        read_telemetry_log("cg_telemetry.bin", log);
+        double spmv = 0.0, vector = 0.0;
+        for (const TelemetryRecord& r : log) {
+            spmv += r.spmv_seconds;
+            vector += r.vector_seconds;
+        }
+        const double plain_ms = std::chrono::duration<double, std::milli>(tp2 - tp1).count();
+        const double traced_ms = std::chrono::duration<double, std::milli>(tt2 - tt1).count();
+        std::cout << "Telemetry: " << log.size() << " records logged, " << telemetry.dropped() << " dropped, spmv " << spmv * 1e3
+                  << "ms, vector ops " << vector * 1e3 << "ms; solve " << traced_ms << "ms against " << plain_ms
+                  << "ms without telemetry (" << 100.0 * (traced_ms - plain_ms) / plain_ms << "%)" << std::endl;
+    } else if (variant == "cg-checkpoint") {
+        const int every_iterations = argc > 3 ? std::atoi(argv[3]) : 100;
+        const double every_seconds = argc > 4 ? std::atof(argv[4]) : 0.0;
+        const char* path = "cg_checkpoint.bin";
+        std::remove(path);
+        CSROperator A(val_array, col_array, row_start_array);
+        // Reference run without checkpoints
+        std::vector<double> x_ref(n, 0.0);
+        auto tr1 = std::chrono::high_resolution_clock::now();
+        int reference = conjugate_gradient(A, b_array, x_ref.data(), n, max_iterations, tolerance, nullptr, nullptr, nullptr, nullptr,
+                                           nullptr, false);
+        auto tr2 = std::chrono::high_resolution_clock::now();
+        // Same solve with checkpoints, "preempted" after 60% of the reference iterations
+        std::vector<double> x_lost(n, 0.0);
+        int saves = 0;
+        auto tc1 = std::chrono::high_resolution_clock::now();
+        {
+            CGCheckpoint checkpoint(path, every_iterations, every_seconds);
+            conjugate_gradient(A, b_array, x_lost.data(), n, reference * 6 / 10, tolerance, nullptr, nullptr, nullptr, nullptr, &checkpoint,
+                               false);
+            saves = checkpoint.saves();
+        }
+        auto tc2 = std::chrono::high_resolution_clock::now();
+        // Restart: picks up the last checkpoint and finishes the solve
+        CGCheckpoint checkpoint(path, every_iterations, every_seconds);
+        iterations = conjugate_gradient(A, b_array, x_array, n, max_iterations, tolerance, nullptr, nullptr, nullptr, nullptr, &checkpoint,
+                                        false);
+        double max_diff = 0.0;
+        for (int i = 0; i < n; ++i) max_diff = std::max(max_diff, fabs(x_array[i] - x_ref[i]));
+        const double reference_ms = std::chrono::duration<double, std::milli>(tr2 - tr1).count();
+        const double interrupted_ms = std::chrono::duration<double, std::milli>(tc2 - tc1).count();
+        std::cout << "Reference " << reference << " iterations in " << reference_ms << "ms; interrupted run " << reference * 6 / 10
+                  << " iterations with " << saves << " checkpoints in " << interrupted_ms << "ms (" << interrupted_ms / (reference * 6 / 10)
+                  << "ms/iteration against " << reference_ms / reference << "); resumed run ended at iteration " << iterations
+                  << ", max |x - x_ref| " << max_diff << std::endl;
+    } else if (variant == "bicgstab" || variant == "gmres") {
+        const double peclet = argc > 3 ? std::atof(argv[3]) : 1.0;
+        const int restart = argc > 4 ? std::atoi(argv[4]) : 30;
+        CSRMatrix C = build_convection_diffusion_2d(gridSize, peclet);
+        CSROperator A(C.values.data(), C.col_indices.data(), C.row_start.data());
+        SchwarzPreconditioner ilu(C.values.data(), C.col_indices.data(), C.row_start.data(), n);
+        auto solve = [&](Preconditioner* precond, double* xs) {
+            return variant == "bicgstab" ? bicgstab(A, b_array, xs, n, max_iterations, tolerance, precond, false)
+                                         : gmres(A, b_array, xs, n, restart, max_iterations, tolerance, precond, false);
+        };
+        std::vector<double> x_plain(n, 0.0), Ax(n);
+        auto tp1 = std::chrono::high_resolution_clock::now();
+        int plain = solve(nullptr, x_plain.data());
+        auto tp2 = std::chrono::high_resolution_clock::now();
+        iterations = solve(&ilu, x_array);
+        auto tp3 = std::chrono::high_resolution_clock::now();
+        A.apply(x_array, Ax.data(), n);
+        double rr = 0.0;
+        for (int i = 0; i < n; ++i) rr += (b_array[i] - Ax[i]) * (b_array[i] - Ax[i]);
+        std::cout << "Convection-diffusion, cell Peclet " << peclet << ": unpreconditioned " << plain << " iterations in "
+                  << std::chrono::duration<double, std::milli>(tp2 - tp1).count() << "ms, block ILU(0) " << iterations << " iterations in "
+                  << std::chrono::duration<double, std::milli>(tp3 - tp2).count() << "ms, true residual " << sqrt(rr) << std::endl;
+    } else if (variant == "cholesky") {
+        const int nrhs = argc > 3 ? std::atoi(argv[3]) : 100;
+        SparseCholesky chol;
+        auto tc1 = std::chrono::high_resolution_clock::now();
+        chol.analyse(col_array, row_start_array, n);
+        auto tc2 = std::chrono::high_resolution_clock::now();
+        chol.factorise(val_array, col_array, row_start_array);
+        auto tc3 = std::chrono::high_resolution_clock::now();
+        std::vector<double> rhs(n), Ax(n);
+        double solve_ms = 0.0, max_residual = 0.0;
+        for (int k = 0; k < nrhs; ++k) {
+            for (int i = 0; i < n; ++i) rhs[i] = 1.0 + 0.5 * sin(0.001 * (k + 1) * i);
+            auto ts1 = std::chrono::high_resolution_clock::now();
+            chol.solve(rhs.data(), x_array);
+            auto ts2 = std::chrono::high_resolution_clock::now();
+            solve_ms += std::chrono::duration<double, std::milli>(ts2 - ts1).count();
+            matrix_vector_multiply_csr(val_array, col_array, row_start_array, x_array, Ax.data(), n);
+            double rr = 0.0;
+            for (int i = 0; i < n; ++i) rr += (rhs[i] - Ax[i]) * (rhs[i] - Ax[i]);
+            max_residual = std::max(max_residual, sqrt(rr));
+        }
+        std::cout << "Supernodes " << chol.first.size() - 1 << ", nnz(L) " << chol.nnz_l << " (fill " << (double)chol.nnz_l / nnz
+                  << "x nnz(A)), analyse " << std::chrono::duration<double, std::milli>(tc2 - tc1).count() << "ms, factorise "
+                  << std::chrono::duration<double, std::milli>(tc3 - tc2).count() << "ms, " << solve_ms / nrhs << "ms per solve over "
+                  << nrhs << " right-hand sides, max residual " << max_residual << std::endl;
+        chol.solve(b_array, x_array);
+    } else {
+        iterations = conjugate_gradient_csr(val_array, col_array, row_start_array, b_array, x_array, n, max_iterations, tolerance);
+    }
+    std::cout << variant << " iterations " << iterations << std::endl;
     auto t2 = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double, std::milli> ms_double = t2 - t1;
     std::cout << ms_double.count() << "ms\n";
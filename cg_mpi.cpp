@@ -0,0 +1,233 @@
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <mpi.h>
+
+// Distributed-memory CG for the same 2D Laplacian as cg.cpp. Rows are distributed in
+// contiguous blocks; each rank assembles only its own rows. The local matrix is split into
+// the part that touches owned columns and the part that touches ghost columns, so the local
+// SpMV can run while the halo exchange is in flight.
+//
+// Build: mpicxx -O3 -o cg_mpi cg_mpi.cpp
+// Run:   mpirun -np 4 ./cg_mpi [gridSize]
+
+struct DistributedCSR {
+    int first_row, local_rows;
+    // Owned columns, numbered locally 0..local_rows-1
+    std::vector<double> values;
+    std::vector<int> col_indices, row_start;
+    // Ghost columns, numbered 0..ghost_count-1 in the order they are received
+    std::vector<double> ghost_values;
+    std::vector<int> ghost_col_indices, ghost_row_start;
+    int ghost_count = 0;
+
+    // Halo communication lists: for each neighbour rank, which ghost slots it fills and which
+    // of our local entries it needs
+    std::vector<int> recv_ranks, recv_offsets;   // ghosts [recv_offsets[k], recv_offsets[k+1]) come from recv_ranks[k]
+    std::vector<int> send_ranks, send_offsets, send_indices;
+    std::vector<double> send_buffer, ghost_buffer;
+};
+
+int owner_of(int global_row, const std::vector<int>& row_offsets) {
+    return std::upper_bound(row_offsets.begin(), row_offsets.end(), global_row) - row_offsets.begin() - 1;
+}
+
+// Assembles the local rows of the 5-point Laplacian and sets up the ghost communication lists
+void build_distributed_laplacian(int gridSize, int rank, int size, DistributedCSR& A) {
+    const int n = gridSize * gridSize;
+    std::vector<int> row_offsets(size + 1);
+    for (int r = 0; r <= size; ++r) row_offsets[r] = (long long)n * r / size;
+    A.first_row = row_offsets[rank];
+    A.local_rows = row_offsets[rank + 1] - row_offsets[rank];
+    const int last_row = A.first_row + A.local_rows;
+
+    // Global column -> ghost slot; ghosts are grouped by owner rank so each neighbour's
+    // values arrive in one contiguous block
+    std::vector<int> ghost_globals;
+    std::vector<std::pair<int, double>> ghost_entries;   // (global column, value) in row order
+    A.row_start.assign(A.local_rows + 1, 0);
+    A.ghost_row_start.assign(A.local_rows + 1, 0);
+    for (int li = 0; li < A.local_rows; ++li) {
+        const int i = A.first_row + li;
+        int neighbours[5] = {i, -1, -1, -1, -1};
+        double coefficients[5] = {4.0, -1.0, -1.0, -1.0, -1.0};
+        if (i >= gridSize) neighbours[1] = i - gridSize;
+        if (i % gridSize != 0) neighbours[2] = i - 1;
+        if ((i + 1) % gridSize != 0) neighbours[3] = i + 1;
+        if (i < n - gridSize) neighbours[4] = i + gridSize;
+        for (int k = 0; k < 5; ++k) {
+            const int j = neighbours[k];
+            if (j < 0) continue;
+            if (j >= A.first_row && j < last_row) {
+                A.values.push_back(coefficients[k]);
+                A.col_indices.push_back(j - A.first_row);
+            } else {
+                ghost_entries.push_back({j, coefficients[k]});
+                ghost_globals.push_back(j);
+            }
+        }
+        A.row_start[li + 1] = A.values.size();
+        A.ghost_row_start[li + 1] = ghost_entries.size();
+    }
+    // Sorting the global indices groups them by owner since the distribution is contiguous
+    std::sort(ghost_globals.begin(), ghost_globals.end());
+    ghost_globals.erase(std::unique(ghost_globals.begin(), ghost_globals.end()), ghost_globals.end());
+    A.ghost_count = ghost_globals.size();
+    for (auto& entry : ghost_entries) {
+        A.ghost_values.push_back(entry.second);
+        A.ghost_col_indices.push_back(std::lower_bound(ghost_globals.begin(), ghost_globals.end(), entry.first) - ghost_globals.begin());
+    }
+
+    // Receive lists and the number of indices we request from every rank
+    std::vector<int> request_counts(size, 0);
+    A.recv_offsets.push_back(0);
+    for (int g = 0; g < A.ghost_count; ++g) {
+        const int owner = owner_of(ghost_globals[g], row_offsets);
+        if (A.recv_ranks.empty() || A.recv_ranks.back() != owner) {
+            A.recv_ranks.push_back(owner);
+            A.recv_offsets.push_back(A.recv_offsets.back());
+        }
+        A.recv_offsets.back()++;
+        request_counts[owner]++;
+    }
+
+    // Tell every owner which of its rows we need; its answer becomes its send list
+    std::vector<int> send_counts(size);
+    MPI_Alltoall(request_counts.data(), 1, MPI_INT, send_counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    std::vector<int> request_displs(size + 1, 0), send_displs(size + 1, 0);
+    for (int r = 0; r < size; ++r) {
+        request_displs[r + 1] = request_displs[r] + request_counts[r];
+        send_displs[r + 1] = send_displs[r] + send_counts[r];
+    }
+    std::vector<int> requested(send_displs[size]);
+    MPI_Alltoallv(ghost_globals.data(), request_counts.data(), request_displs.data(), MPI_INT,
+                  requested.data(), send_counts.data(), send_displs.data(), MPI_INT, MPI_COMM_WORLD);
+    A.send_offsets.push_back(0);
+    for (int r = 0; r < size; ++r) {
+        if (send_counts[r] == 0) continue;
+        A.send_ranks.push_back(r);
+        for (int k = send_displs[r]; k < send_displs[r + 1]; ++k) {
+            A.send_indices.push_back(requested[k] - A.first_row);
+        }
+        A.send_offsets.push_back(A.send_indices.size());
+    }
+    A.send_buffer.resize(A.send_indices.size());
+    A.ghost_buffer.resize(A.ghost_count);
+}
+
+// y = A*x with the halo exchange overlapped with the owned-column part of the product
+void distributed_spmv(DistributedCSR& A, const double* x, double* y) {
+    std::vector<MPI_Request> requests(A.recv_ranks.size() + A.send_ranks.size());
+    int nreq = 0;
+    for (size_t k = 0; k < A.recv_ranks.size(); ++k) {
+        MPI_Irecv(&A.ghost_buffer[A.recv_offsets[k]], A.recv_offsets[k + 1] - A.recv_offsets[k], MPI_DOUBLE,
+                  A.recv_ranks[k], 0, MPI_COMM_WORLD, &requests[nreq++]);
+    }
+    for (size_t s = 0; s < A.send_indices.size(); ++s) {
+        A.send_buffer[s] = x[A.send_indices[s]];
+    }
+    for (size_t k = 0; k < A.send_ranks.size(); ++k) {
+        MPI_Isend(&A.send_buffer[A.send_offsets[k]], A.send_offsets[k + 1] - A.send_offsets[k], MPI_DOUBLE,
+                  A.send_ranks[k], 0, MPI_COMM_WORLD, &requests[nreq++]);
+    }
+
+    for (int i = 0; i < A.local_rows; ++i) {
+        double sum = 0.0;
+        for (int j = A.row_start[i]; j < A.row_start[i + 1]; ++j) {
+            sum += A.values[j] * x[A.col_indices[j]];
+        }
+        y[i] = sum;
+    }
+
+    MPI_Waitall(nreq, requests.data(), MPI_STATUSES_IGNORE);
+    for (int i = 0; i < A.local_rows; ++i) {
+        double sum = 0.0;
+        for (int j = A.ghost_row_start[i]; j < A.ghost_row_start[i + 1]; ++j) {
+            sum += A.ghost_values[j] * A.ghost_buffer[A.ghost_col_indices[j]];
+        }
+        y[i] += sum;
+    }
+}
+
+double distributed_dot(const double* a, const double* b, int n) {
+    double local = 0.0;
+    for (int i = 0; i < n; ++i) {
+        local += a[i] * b[i];
+    }
+    double global = 0.0;
+    MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    return global;
+}
+
+int conjugate_gradient_mpi(DistributedCSR& A, const double* b, double* x, int max_iterations, double tolerance, int rank) {
+    const int n = A.local_rows;
+    std::vector<double> r(n), p(n), Ap(n);
+
+    distributed_spmv(A, x, Ap.data());
+    for (int i = 0; i < n; ++i) {
+        r[i] = b[i] - Ap[i];
+        p[i] = r[i];
+    }
+    double rsold = distributed_dot(r.data(), r.data(), n);
+
+    int iterations = max_iterations;
+    for (int it = 0; it < max_iterations; ++it) {
+        distributed_spmv(A, p.data(), Ap.data());
+        double alpha = rsold / distributed_dot(p.data(), Ap.data(), n);
+        for (int i = 0; i < n; ++i) {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * Ap[i];
+        }
+        double rsnew = distributed_dot(r.data(), r.data(), n);
+
+        if (sqrt(rsnew) < tolerance) {
+            if (rank == 0) std::cout << "Final residual " << sqrt(rsnew) << std::endl;
+            iterations = it + 1;
+            break;
+        } else if (it % 100 == 0 && rank == 0) {
+            std::cout << it << " residual " << sqrt(rsnew) << std::endl;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            p[i] = r[i] + (rsnew / rsold) * p[i];
+        }
+        rsold = rsnew;
+    }
+    return iterations;
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    const int gridSize = argc > 1 ? std::atoi(argv[1]) : 2000;
+    const int n = gridSize * gridSize;
+
+    DistributedCSR A;
+    build_distributed_laplacian(gridSize, rank, size, A);
+    std::vector<double> b(A.local_rows, 1.0); // Heat source vector
+    std::vector<double> x(A.local_rows, 0.0); // Solution vector
+
+    int max_iterations = 1000;
+    double tolerance = 1e-8;
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t1 = MPI_Wtime();
+    int iterations = conjugate_gradient_mpi(A, b.data(), x.data(), max_iterations, tolerance, rank);
+    double t2 = MPI_Wtime();
+
+    // The rank owning the middle row prints the same sample point as cg.cpp
+    const int sample = n / 2;
+    if (sample >= A.first_row && sample < A.first_row + A.local_rows) {
+        std::cout << "Temperature at (" << sample / gridSize << ", " << sample % gridSize << ") = " << x[sample - A.first_row] << std::endl;
+    }
+    if (rank == 0) {
+        std::cout << size << " ranks, " << iterations << " iterations, " << (t2 - t1) * 1e3 << "ms" << std::endl;
+    }
+
+    MPI_Finalize();
+    return 0;
+}